@@ -72,7 +72,7 @@ on_revert_button_clicked               (GtkButton       *button,
                                         gpointer         user_data)
 {
     GError *error = NULL;
-    if (!lobster_system_load (&error)) {
+    if (!lobster_system_load_devices (&error)) {
         lobster_show_error (_("<b>Could not load network configuration; configuration may be incomplete:</b>"), error);
         g_error_free (error);
         /* should this exit? */
@@ -80,15 +80,31 @@ on_revert_button_clicked               (GtkButton       *button,
     lobster_system_display ();
 }
 
+/* saves from here that haven't finished; the dialog stays editable
+ * until they run, so several can share a run and its error */
+static guint applies_pending;
+
+static void
+on_apply_saved (GError *error, guint merged, gpointer data)
+{
+    /* the last of a run's saves shows its error */
+    if (--applies_pending == 0 && error) {
+        lobster_show_error (_("<b>Could not save network configuration:</b>"), error);
+        /* the edits are still there to apply again */
+        lobster_is_valid ();
+    }
+    /* data is set when the save was to close the dialog */
+    if (!error && data) {
+        gtk_main_quit ();
+    }
+}
+
 void
 on_apply_button_clicked                (GtkButton       *button,
                                         gpointer         user_data)
 {
-    GError *error = NULL;
-    if (!lobster_system_save (&error)) {
-        lobster_show_error (_("<b>Could not save network configuration:</b>"), error);
-        g_error_free (error);
-    }
+    applies_pending++;
+    lobster_system_save (on_apply_saved, NULL);
     ENABLED ("network_revert_button", FALSE);
     ENABLED ("network_apply_button", FALSE);    
 }
@@ -98,7 +114,6 @@ void
 on_close_button_clicked                (GtkButton       *button,
                                         gpointer         user_data)
 {
-    GError *error = NULL;
     if (lobster_is_dirty ()) {
         GtkWidget *dialog = create_changes_dialog ();
         int res = gtk_dialog_run (GTK_DIALOG (dialog));
@@ -108,12 +123,10 @@ on_close_button_clicked                (GtkButton       *button,
             if (!lobster_is_valid ()) {
                 return;
             }
-            if (!lobster_system_save (&error)) {
-                lobster_show_error (_("<b>Could not save network configuration:</b>"), error);
-                g_error_free (error);
-                return;
-            }
-            break;
+            /* quits once the changes are applied */
+            applies_pending++;
+            lobster_system_save (on_apply_saved, GINT_TO_POINTER (TRUE));
+            return;
         case GTK_RESPONSE_REJECT:
             break;
         case GTK_RESPONSE_CANCEL:
@@ -174,3 +187,21 @@ on_nm_button_clicked                   (GtkButton       *button,
         g_error_free (error);
     }
 }
+
+gboolean
+on_undo_activated                      (GtkAccelGroup   *accel_group,
+                                        GObject         *acceleratable,
+                                        guint            keyval,
+                                        GdkModifierType  modifier)
+{
+    return lobster_undo ();
+}
+
+gboolean
+on_redo_activated                      (GtkAccelGroup   *accel_group,
+                                        GObject         *acceleratable,
+                                        guint            keyval,
+                                        GdkModifierType  modifier)
+{
+    return lobster_redo ();
+}
@@ -56,3 +56,15 @@ on_apply_button_clicked                (GtkButton       *button,
 void
 on_nm_button_clicked                   (GtkButton       *button,
                                         gpointer         user_data);
+
+gboolean
+on_undo_activated                      (GtkAccelGroup   *accel_group,
+                                        GObject         *acceleratable,
+                                        guint            keyval,
+                                        GdkModifierType  modifier);
+
+gboolean
+on_redo_activated                      (GtkAccelGroup   *accel_group,
+                                        GObject         *acceleratable,
+                                        guint            keyval,
+                                        GdkModifierType  modifier);
@@ -394,23 +394,30 @@ GtkWidget*
 create_applying_dialog (void)
 {
   GtkWidget *applying_dialog;
+  GtkWidget *applying_vbox;
   GtkWidget *applying_hbox;
   GtkWidget *applying_image;
   GtkWidget *applying_label;
+  GtkWidget *applying_scrolled;
+  GtkWidget *applying_text;
+  GtkWidget *applying_actions;
+  GtkWidget *applying_cancel_button;
 
-  applying_dialog = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  applying_dialog = gtk_dialog_new ();
   gtk_widget_set_name (applying_dialog, "applying_dialog");
   gtk_window_set_title (GTK_WINDOW (applying_dialog), _("Network Settings"));
   gtk_window_set_position (GTK_WINDOW (applying_dialog), GTK_WIN_POS_CENTER_ON_PARENT);
   gtk_window_set_modal (GTK_WINDOW (applying_dialog), TRUE);
-  gtk_window_set_resizable (GTK_WINDOW (applying_dialog), FALSE);
   gtk_window_set_type_hint (GTK_WINDOW (applying_dialog), GDK_WINDOW_TYPE_HINT_DIALOG);
 
+  applying_vbox = GTK_DIALOG (applying_dialog)->vbox;
+  gtk_widget_set_name (applying_vbox, "applying_vbox");
+  gtk_widget_show (applying_vbox);
+
   applying_hbox = gtk_hbox_new (FALSE, 0);
   gtk_widget_set_name (applying_hbox, "applying_hbox");
   gtk_widget_show (applying_hbox);
-  gtk_container_add (GTK_CONTAINER (applying_dialog), applying_hbox);
-  gtk_container_set_border_width (GTK_CONTAINER (applying_hbox), 20);
+  gtk_box_pack_start (GTK_BOX (applying_vbox), applying_hbox, FALSE, TRUE, 20);
 
   applying_image = gtk_image_new_from_icon_name ("gtk-dialog-info", GTK_ICON_SIZE_DIALOG);
   gtk_widget_set_name (applying_image, "applying_image");
@@ -423,11 +430,44 @@ create_applying_dialog (void)
   gtk_box_pack_start (GTK_BOX (applying_hbox), applying_label, TRUE, TRUE, 20);
   gtk_misc_set_padding (GTK_MISC (applying_label), 4, 0);
 
+  applying_scrolled = gtk_scrolled_window_new (NULL, NULL);
+  gtk_widget_set_name (applying_scrolled, "applying_scrolled");
+  gtk_widget_show (applying_scrolled);
+  gtk_box_pack_start (GTK_BOX (applying_vbox), applying_scrolled, TRUE, TRUE, 0);
+  gtk_widget_set_size_request (applying_scrolled, 480, 160);
+  gtk_container_set_border_width (GTK_CONTAINER (applying_scrolled), 10);
+  gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (applying_scrolled), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (applying_scrolled), GTK_SHADOW_IN);
+
+  applying_text = gtk_text_view_new ();
+  gtk_widget_set_name (applying_text, "applying_text");
+  gtk_widget_show (applying_text);
+  gtk_container_add (GTK_CONTAINER (applying_scrolled), applying_text);
+  gtk_text_view_set_editable (GTK_TEXT_VIEW (applying_text), FALSE);
+  gtk_text_view_set_wrap_mode (GTK_TEXT_VIEW (applying_text), GTK_WRAP_CHAR);
+  gtk_text_view_set_cursor_visible (GTK_TEXT_VIEW (applying_text), FALSE);
+
+  applying_actions = GTK_DIALOG (applying_dialog)->action_area;
+  gtk_widget_set_name (applying_actions, "applying_actions");
+  gtk_widget_show (applying_actions);
+  gtk_button_box_set_layout (GTK_BUTTON_BOX (applying_actions), GTK_BUTTONBOX_END);
+
+  applying_cancel_button = gtk_button_new_from_stock ("gtk-cancel");
+  gtk_widget_set_name (applying_cancel_button, "applying_cancel_button");
+  gtk_widget_show (applying_cancel_button);
+  gtk_dialog_add_action_widget (GTK_DIALOG (applying_dialog), applying_cancel_button, GTK_RESPONSE_CANCEL);
+  GTK_WIDGET_SET_FLAGS (applying_cancel_button, GTK_CAN_DEFAULT);
+
   /* Store pointers to all widgets, for use by lookup_widget(). */
   GLADE_HOOKUP_OBJECT_NO_REF (applying_dialog, applying_dialog, "applying_dialog");
+  GLADE_HOOKUP_OBJECT_NO_REF (applying_dialog, applying_vbox, "applying_vbox");
   GLADE_HOOKUP_OBJECT (applying_dialog, applying_hbox, "applying_hbox");
   GLADE_HOOKUP_OBJECT (applying_dialog, applying_image, "applying_image");
   GLADE_HOOKUP_OBJECT (applying_dialog, applying_label, "applying_label");
+  GLADE_HOOKUP_OBJECT (applying_dialog, applying_scrolled, "applying_scrolled");
+  GLADE_HOOKUP_OBJECT (applying_dialog, applying_text, "applying_text");
+  GLADE_HOOKUP_OBJECT_NO_REF (applying_dialog, applying_actions, "applying_actions");
+  GLADE_HOOKUP_OBJECT (applying_dialog, applying_cancel_button, "applying_cancel_button");
 
   return applying_dialog;
 }
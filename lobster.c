@@ -3,24 +3,42 @@
 #include "lobster.h"
 
 #include "lobsterio.h"
+#include "lobsterarena.h"
+#include "lobstercache.h"
+#include "lobsternetlink.h"
+#include "lobsterschema.h"
+#include "lobstertrie.h"
 
 #include "support.h"
 #include "interface.h"
 
 #include <glib/gstring.h>
 
+#include <errno.h>
+#include <ifaddrs.h>
+#include <signal.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <wait.h>
 
 #define NET_DEVICES "/proc/net/dev"
 #define NETWORK_CONFIG "/etc/sysconfig/network/config"
 #define NETWORK_IFCFG "/etc/sysconfig/network/ifcfg"
+#define NETWORK_JOURNAL "/etc/sysconfig/network/.lobster-configurator.journal"
 #define NETWORK_ROUTES "/etc/sysconfig/network/routes"
 #define RESOLV_CONF "/etc/resolv.conf"
 
+#define SERVICE "/sbin/service"
+#define IFUP "/sbin/ifup"
+#define IFDOWN "/sbin/ifdown"
+#define IFUP_ROUTE "/etc/sysconfig/network/scripts/ifup-route"
+#define NSCD "/usr/sbin/nscd"
+
 LobsterSystem lobster;
 
 void
@@ -47,292 +65,2888 @@ lobster_ignore_edits (void)
 void
 lobster_accept_edits (void)
 {
-    --lobster.ignore_edits;
+    --lobster.ignore_edits;
+}
+
+static char *
+view_text (const char *name)
+{
+    GtkTextBuffer *buf = BUFFER (name);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_start_iter (buf, &start);
+    gtk_text_buffer_get_end_iter (buf, &end);
+    return gtk_text_buffer_get_text (buf, &start, &end, FALSE);
+}
+
+/* where strings read from files go: the next generation's arena while
+ * the system loads, the published one otherwise */
+static LobsterArena *load_arena;
+
+/*
+ * Only the main thread publishes, so it reads published directly.
+ * Other threads count themselves in as readers around loading it and
+ * taking a reference; a snapshot that was replaced keeps the reference
+ * publishing gave it until no reader is counted in, since one of them
+ * may have loaded it without yet holding its own.
+ */
+static LobsterSnapshot *published;
+static gint             readers;
+static GSList          *retired;
+
+/* the snapshot as loaded or last applied, which edits are diffed
+ * against */
+static LobsterSnapshot *saved_snapshot;
+
+LobsterInterface *
+lobster_interface_ref (LobsterInterface *iface)
+{
+    g_atomic_int_inc (&iface->ref_count);
+    return iface;
+}
+
+/* the memory belongs to the arena the interface was made in; this only
+ * releases what lives outside it, and a copy's hold on its arena */
+void
+lobster_interface_unref (LobsterInterface *iface)
+{
+    LobsterArena *arena;
+
+    if (!iface || !g_atomic_int_dec_and_test (&iface->ref_count)) {
+        return;
+    }
+    if (iface->extra) {
+        g_hash_table_unref (iface->extra);
+    }
+    /* which may free iface */
+    arena = iface->arena;
+    lobster_arena_unref (arena);
+}
+
+/* interface must belong to arena too */
+static LobsterInterface *
+interface_new (LobsterArena *arena, char *interface)
+{
+    LobsterInterface *iface = lobster_arena_new0 (arena, LobsterInterface);
+    iface->ref_count = 1;
+    iface->interface = interface;
+    lobster_address_clear (&iface->address);
+    return iface;
+}
+
+/* shares the strings, which are never written to, and the extra table,
+ * which is never edited; the copy holds arena */
+static LobsterInterface *
+interface_copy (LobsterArena *arena, const LobsterInterface *iface)
+{
+    LobsterInterface *copy = lobster_arena_new0 (arena, LobsterInterface);
+    *copy = *iface;
+    copy->ref_count = 1;
+    copy->arena = lobster_arena_ref (arena);
+    if (copy->extra) {
+        g_hash_table_ref (copy->extra);
+    }
+    return copy;
+}
+
+/*
+ * A snapshot keeps its interfaces in chunks, which are shared between
+ * generations the way interfaces are, so a new generation copies a
+ * pointer per chunk rather than per interface.
+ */
+#define CHUNK_SIZE 64
+
+struct _LobsterInterfaceChunk {
+    gint              ref_count;
+    LobsterInterface *interfaces[CHUNK_SIZE];   /* NULL past the end */
+};
+
+#define N_CHUNKS(n) (((n) + CHUNK_SIZE - 1) / CHUNK_SIZE)
+
+static void
+chunk_unref (LobsterInterfaceChunk *chunk)
+{
+    guint i;
+
+    if (!g_atomic_int_dec_and_test (&chunk->ref_count)) {
+        return;
+    }
+    for (i = 0; i < CHUNK_SIZE; i++) {
+        lobster_interface_unref (chunk->interfaces[i]);
+    }
+    g_free (chunk);
+}
+
+static LobsterInterfaceChunk *
+chunk_copy (const LobsterInterfaceChunk *chunk)
+{
+    LobsterInterfaceChunk *copy = g_new (LobsterInterfaceChunk, 1);
+    guint i;
+
+    *copy = *chunk;
+    copy->ref_count = 1;
+    for (i = 0; i < CHUNK_SIZE && copy->interfaces[i]; i++) {
+        lobster_interface_ref (copy->interfaces[i]);
+    }
+    return copy;
+}
+
+LobsterSnapshot *
+lobster_snapshot_ref (LobsterSnapshot *snap)
+{
+    g_atomic_int_inc (&snap->ref_count);
+    return snap;
+}
+
+void
+lobster_snapshot_unref (LobsterSnapshot *snap)
+{
+    guint i;
+
+    if (!snap || !g_atomic_int_dec_and_test (&snap->ref_count)) {
+        return;
+    }
+    for (i = 0; i < N_CHUNKS (snap->n_interfaces); i++) {
+        chunk_unref (snap->chunks[i]);
+    }
+    g_free (snap->chunks);
+    g_hash_table_unref (snap->interfaces_by_name);
+    lobster_arena_unref (snap->system_arena);
+    lobster_arena_unref (snap->edits);
+    lobster_arena_unref (snap->arena);
+    g_free (snap);
+}
+
+LobsterSnapshot *
+lobster_snapshot_get (void)
+{
+    LobsterSnapshot *snap;
+
+    g_atomic_int_inc (&readers);
+    snap = g_atomic_pointer_get (&published);
+    if (snap) {
+        lobster_snapshot_ref (snap);
+    }
+    g_atomic_int_add (&readers, -1);
+
+    return snap;
+}
+
+LobsterInterface *
+lobster_snapshot_get_nth (LobsterSnapshot *snap, guint index)
+{
+    return index < snap->n_interfaces ? snap->chunks[index / CHUNK_SIZE]->interfaces[index % CHUNK_SIZE] : NULL;
+}
+
+LobsterInterface *
+lobster_snapshot_get_from_device (LobsterSnapshot *snap, const char *interface)
+{
+    guint index = snap ? GPOINTER_TO_UINT (g_hash_table_lookup (snap->interfaces_by_name, interface)) : 0;
+    return index ? lobster_snapshot_get_nth (snap, index - 1) : NULL;
+}
+
+/* an empty snapshot of its own, taking the reference to arena */
+static LobsterSnapshot *
+snapshot_new (LobsterArena *arena)
+{
+    LobsterSnapshot *snap = g_new0 (LobsterSnapshot, 1);
+    snap->ref_count = 1;
+    snap->arena = arena;
+    snap->interfaces_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+    return snap;
+}
+
+/* the next generation, to be edited and then published; it shares
+ * everything with the published one until edited */
+static LobsterSnapshot *
+snapshot_draft (void)
+{
+    LobsterSnapshot *snap;
+    guint i, n_chunks;
+
+    if (!published) {
+        return snapshot_new (lobster_arena_new ());
+    }
+
+    snap = g_new (LobsterSnapshot, 1);
+    *snap = *published;
+    snap->ref_count = 1;
+    lobster_arena_ref (snap->arena);
+    snap->edits = NULL;
+    if (snap->system_arena) {
+        lobster_arena_ref (snap->system_arena);
+    }
+    g_hash_table_ref (snap->interfaces_by_name);
+    n_chunks = N_CHUNKS (snap->n_interfaces);
+    snap->chunks = g_new (LobsterInterfaceChunk *, n_chunks);
+    memcpy (snap->chunks, published->chunks, n_chunks * sizeof (LobsterInterfaceChunk *));
+    for (i = 0; i < n_chunks; i++) {
+        g_atomic_int_inc (&snap->chunks[i]->ref_count);
+    }
+    return snap;
+}
+
+/* where the draft's edits go; a generation's edits are released once
+ * it has retired and nothing that lives on uses them, where memory
+ * from the load arena would stay until the next load */
+static LobsterArena *
+snapshot_edits (LobsterSnapshot *draft)
+{
+    if (!draft->edits) {
+        draft->edits = lobster_arena_new ();
+    }
+    return draft->edits;
+}
+
+/* the chunk holding index, copied first unless the draft is all that
+ * holds it */
+static LobsterInterfaceChunk *
+snapshot_edit_chunk (LobsterSnapshot *draft, guint index)
+{
+    LobsterInterfaceChunk **chunk = &draft->chunks[index / CHUNK_SIZE];
+    if (g_atomic_int_get (&(*chunk)->ref_count) > 1) {
+        LobsterInterfaceChunk *copy = chunk_copy (*chunk);
+        chunk_unref (*chunk);
+        *chunk = copy;
+    }
+    return *chunk;
+}
+
+/* the interface at index, copied first unless the draft is all that
+ * holds it */
+static LobsterInterface *
+snapshot_edit_interface (LobsterSnapshot *draft, guint index)
+{
+    LobsterInterface **iface = &snapshot_edit_chunk (draft, index)->interfaces[index % CHUNK_SIZE];
+    if (g_atomic_int_get (&(*iface)->ref_count) > 1) {
+        LobsterInterface *copy = interface_copy (snapshot_edits (draft), *iface);
+        lobster_interface_unref (*iface);
+        *iface = copy;
+    }
+    return *iface;
+}
+
+/* puts iface at its index, taking the reference */
+static void
+snapshot_set_interface (LobsterSnapshot *draft, LobsterInterface *iface)
+{
+    LobsterInterface **slot = &snapshot_edit_chunk (draft, iface->index)->interfaces[iface->index % CHUNK_SIZE];
+    lobster_interface_unref (*slot);
+    *slot = iface;
+}
+
+/* takes the draft's reference */
+static void
+snapshot_publish (LobsterSnapshot *draft)
+{
+    LobsterSnapshot *old = published;
+    GSList *l;
+
+    draft->generation = old ? old->generation + 1 : 1;
+    g_atomic_pointer_set (&published, draft);
+
+    if (old) {
+        retired = g_slist_prepend (retired, old);
+    }
+    if (g_atomic_int_get (&readers) == 0) {
+        for (l = retired; l; l = l->next) {
+            lobster_snapshot_unref (l->data);
+        }
+        g_slist_free (retired);
+        retired = NULL;
+    }
+}
+
+static gboolean
+same_text (const char *a, const char *b)
+{
+    return !strcmp (a ? a : "", b ? b : "");
+}
+
+/* the system bits for the resolver fields in dirty */
+static guint
+resolver_fields (guint dirty)
+{
+    return (dirty & LOBSTER_RESOLVER_SERVERS ? LOBSTER_SYSTEM_DNS_SERVERS : 0) |
+        (dirty & LOBSTER_RESOLVER_SEARCH ? LOBSTER_SYSTEM_DNS_SEARCH : 0) |
+        (dirty & LOBSTER_RESOLVER_OPTIONS ? LOBSTER_SYSTEM_DNS_OPTIONS : 0);
+}
+
+static guint
+system_diff (const LobsterSnapshot *snap)
+{
+    const LobsterSnapshot *saved = saved_snapshot;
+    guint dirty = resolver_fields (lobster_resolver_diff (snap->resolver, saved->resolver));
+    if (!same_text (snap->router, saved->router)) {
+        dirty |= LOBSTER_SYSTEM_ROUTER;
+    }
+    if (!snap->use_nm != !saved->use_nm) {
+        dirty |= LOBSTER_SYSTEM_USE_NM;
+    }
+    return dirty;
+}
+
+static guint
+interface_diff (const LobsterInterface *iface)
+{
+    const LobsterInterface *saved = iface->saved;
+    guint dirty = 0;
+    if (!lobster_address_equal (&iface->address, &saved->address)) {
+        dirty |= LOBSTER_INTERFACE_ADDRESS;
+    }
+    if (iface->address.prefix != saved->address.prefix) {
+        dirty |= LOBSTER_INTERFACE_SUBNET;
+    }
+    if (!iface->enabled != !saved->enabled) {
+        dirty |= LOBSTER_INTERFACE_ENABLED;
+    }
+    if (!iface->dhcp != !saved->dhcp) {
+        dirty |= LOBSTER_INTERFACE_DHCP;
+    }
+    return dirty;
+}
+
+/* the fields interface_diff() looks at, as they are in iface now */
+static const LobsterInterface *
+interface_baseline (LobsterArena *arena, const LobsterInterface *iface)
+{
+    LobsterInterface *saved = lobster_arena_new0 (arena, LobsterInterface);
+    saved->address = iface->address;
+    saved->cidr = iface->cidr;
+    saved->enabled = iface->enabled;
+    saved->dhcp = iface->dhcp;
+    return saved;
+}
+
+/*
+ * Interface fields that are scanned in bulk are mirrored into columns
+ * indexed like the published snapshot's interfaces, so that checking
+ * thousands of interfaces walks a few dense arrays instead of chasing
+ * a pointer per interface.  They belong to the main thread.
+ */
+enum {
+    COLUMN_STATIC       = 1 << 0,   /* enabled with a static address */
+    COLUMN_BAD_ADDRESS  = 1 << 1,
+    COLUMN_BAD_SUBNET   = 1 << 2,
+    COLUMN_DHCP         = 1 << 3    /* enabled with DHCP */
+};
+
+static GArray     *column_addresses;    /* of LobsterAddress */
+static GByteArray *column_flags;
+
+/* the networks of the good static columns, by index, built when next
+ * wanted after a change; the first two found sharing or nesting are
+ * kept as a conflict */
+static LobsterTrie *column_trie;
+static gboolean     column_has_conflict;
+static guint        column_conflict[2];
+
+static void
+columns_update (const LobsterInterface *iface)
+{
+    guint8 flags = 0;
+
+    if (iface->enabled) {
+        flags |= iface->dhcp ? COLUMN_DHCP : COLUMN_STATIC;
+    }
+    if (iface->address_invalid || iface->address.family == AF_UNSPEC) {
+        flags |= COLUMN_BAD_ADDRESS;
+    }
+    if (iface->subnet_invalid || iface->address.prefix == LOBSTER_ADDRESS_NO_PREFIX) {
+        flags |= COLUMN_BAD_SUBNET;
+    }
+
+    if (!column_flags) {
+        column_addresses = g_array_new (FALSE, FALSE, sizeof (LobsterAddress));
+        column_flags = g_byte_array_new ();
+    }
+    if (iface->index >= column_flags->len) {
+        g_array_set_size (column_addresses, iface->index + 1);
+        g_byte_array_set_size (column_flags, iface->index + 1);
+    }
+    g_array_index (column_addresses, LobsterAddress, iface->index) = iface->address;
+    column_flags->data[iface->index] = flags;
+
+    lobster_trie_free (column_trie);
+    column_trie = NULL;
+}
+
+/* n log n in the columns, against n squared for comparing pairs */
+static LobsterTrie *
+columns_trie (void)
+{
+    guint i, other;
+
+    if (column_trie) {
+        return column_trie;
+    }
+    column_trie = lobster_trie_new (NULL);
+    column_has_conflict = FALSE;
+    for (i = 0; column_flags && i < column_flags->len; i++) {
+        if ((column_flags->data[i] & (COLUMN_STATIC | COLUMN_BAD_ADDRESS | COLUMN_BAD_SUBNET)) != COLUMN_STATIC) {
+            continue;
+        }
+        if (!lobster_trie_insert (column_trie, &g_array_index (column_addresses, LobsterAddress, i), i, &other) &&
+            !column_has_conflict) {
+            column_conflict[0] = other;
+            column_conflict[1] = i;
+            column_has_conflict = TRUE;
+        }
+    }
+    if (!column_has_conflict) {
+        column_has_conflict = lobster_trie_find_overlap (column_trie, &column_conflict[0], &column_conflict[1]);
+    }
+    return column_trie;
+}
+
+/*
+ * Ids are handed out per device name for the life of the process, so
+ * a reload gives an interface back the id it had.  interfaces_by_id is
+ * indexed by id minus one and holds the index in the published
+ * snapshot plus one, or 0 for devices that went away.  Both belong to
+ * the main thread.
+ */
+static GHashTable *interface_ids;
+static GArray     *interfaces_by_id;
+
+static void
+interface_assign_id (LobsterInterface *iface)
+{
+    guint none = 0;
+
+    if (!interface_ids) {
+        interface_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        interfaces_by_id = g_array_new (FALSE, FALSE, sizeof (guint));
+    }
+    iface->id = GPOINTER_TO_UINT (g_hash_table_lookup (interface_ids, iface->interface));
+    if (!iface->id) {
+        g_array_append_val (interfaces_by_id, none);
+        iface->id = interfaces_by_id->len;
+        g_hash_table_insert (interface_ids, g_strdup (iface->interface), GUINT_TO_POINTER (iface->id));
+    }
+    g_array_index (interfaces_by_id, guint, iface->id - 1) = iface->index + 1;
+}
+
+/* adds iface at the end, taking the reference; the name index must be
+ * the snapshot's own and the device name new to it */
+static void
+snapshot_append_interface (LobsterSnapshot *snap, LobsterInterface *iface)
+{
+    LobsterInterfaceChunk *chunk;
+
+    iface->index = snap->n_interfaces++;
+    if (iface->index % CHUNK_SIZE == 0) {
+        snap->chunks = g_renew (LobsterInterfaceChunk *, snap->chunks, N_CHUNKS (snap->n_interfaces));
+        chunk = snap->chunks[iface->index / CHUNK_SIZE] = g_new0 (LobsterInterfaceChunk, 1);
+        chunk->ref_count = 1;
+    }
+    snapshot_set_interface (snap, iface);
+    g_hash_table_insert (snap->interfaces_by_name, iface->interface, GUINT_TO_POINTER (iface->index + 1));
+}
+
+static void
+name_index_copy (gpointer key, gpointer value, gpointer data)
+{
+    g_hash_table_insert (data, key, value);
+}
+
+/* adds iface to a draft, taking the reference and replacing any
+ * interface of the same name */
+static void
+snapshot_add_interface (LobsterSnapshot *draft, LobsterInterface *iface)
+{
+    guint index = GPOINTER_TO_UINT (g_hash_table_lookup (draft->interfaces_by_name, iface->interface));
+    GHashTable *names;
+
+    if (index) {
+        iface->index = index - 1;
+        snapshot_set_interface (draft, iface);
+        return;
+    }
+
+    /* the name index may be shared with published snapshots */
+    names = g_hash_table_new (g_str_hash, g_str_equal);
+    g_hash_table_foreach (draft->interfaces_by_name, name_index_copy, names);
+    g_hash_table_unref (draft->interfaces_by_name);
+    draft->interfaces_by_name = names;
+    snapshot_append_interface (draft, iface);
+}
+
+/* ethernet devices, and bonds, bridges and VLANs that have an ifcfg
+ * file */
+static gboolean
+read_net_devices (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
+{
+    const char *colon;
+    char *ifcfg;
+    gboolean configured;
+
+    while (len && *line == ' ') {
+        ++line;
+        --len;
+    }
+    colon = memchr (line, ':', len);
+    if (!colon || (colon - line == 2 && STARTSWITH_LEN (line, len, "lo"))) {
+        return TRUE;
+    }
+    if (!STARTSWITH_LEN (line, len, "eth")) {
+        ifcfg = g_strdup_printf ("%s-%.*s", NETWORK_IFCFG, (int)(colon - line), line);
+        configured = g_file_test (ifcfg, G_FILE_TEST_IS_REGULAR);
+        g_free (ifcfg);
+        if (!configured) {
+            return TRUE;
+        }
+    }
+    g_ptr_array_add ((GPtrArray *)data, lobster_arena_strndup (load_arena, line, colon - line));
+    fprintf (stderr, "%s:%d: %s\n", file, line_no, (char *)g_ptr_array_index ((GPtrArray *)data, ((GPtrArray *)data)->len - 1));
+    return TRUE;
+}
+
+/* keeps the lines the resolver model reads, for
+ * lobster_resolver_parse() */
+static gboolean
+read_resolv_conf (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
+{
+    if (!STARTSWITH_LEN (line, len, "nameserver") && !STARTSWITH_LEN (line, len, "search") &&
+        !STARTSWITH_LEN (line, len, "domain") && !STARTSWITH_LEN (line, len, "options")) {
+        return TRUE;
+    }
+    fprintf (stderr, "%s:%d: %.*s\n", file, line_no, (int)len, line);
+    g_string_append_len ((GString *)data, line, len);
+    g_string_append_c ((GString *)data, '\n');
+    return TRUE;
+}
+
+static LobsterSchemaKey config_keys[] = {
+    { "NETWORKMANAGER", LOBSTER_SCHEMA_BOOLEAN, LOBSTER_SCHEMA_APPEND, G_STRUCT_OFFSET (LobsterSnapshot, use_nm) },
+};
+
+static LobsterSchema config_schema = LOBSTER_SCHEMA_INIT (LOBSTER_SCHEMA_ASSIGN, '"', config_keys);
+
+static gboolean
+read_config (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
+{
+    if (lobster_schema_read_line (&config_schema, line, len, data, load_arena)) {
+        fprintf (stderr, "%s:%d: %.*s\n", file, line_no, (int)len, line);
+    }
+    return TRUE;
+}
+
+/* only the gateway of the default route is ours; the rest of the line
+ * (netmask, device, options) is left alone */
+static void
+parse_default_route (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    LobsterSnapshot *snap = record;
+    const char *space = memchr (value, ' ', len);
+    if (space) {
+        len = space - value;
+    }
+    if (len) {
+        snap->router = lobster_arena_intern (arena, value, len);
+    }
+}
+
+static char *
+format_default_route (gconstpointer record, const char *old, gsize old_len)
+{
+    const LobsterSnapshot *snap = record;
+    const char *rest = old ? memchr (old, ' ', old_len) : NULL;
+    gsize gateway_len = rest ? rest - old : old_len;
+
+    if (!snap->router || !*snap->router ||
+        (old && strlen (snap->router) == gateway_len && !strncmp (snap->router, old, gateway_len))) {
+        return NULL;
+    }
+    return rest ? g_strdup_printf ("%s%.*s", snap->router, (int)(old + old_len - rest), rest) : g_strdup (snap->router);
+}
+
+static LobsterSchemaKey routes_keys[] = {
+    { "default", LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_APPEND, 0, parse_default_route, format_default_route },
+};
+
+static LobsterSchema routes_schema = LOBSTER_SCHEMA_INIT (LOBSTER_SCHEMA_WORDS, 0, routes_keys);
+
+/* what read_routes() collects */
+typedef struct {
+    LobsterSnapshot *snap;          /* for router */
+    GArray          *routes;        /* of LobsterRoute */
+    guint            n_invalid;
+} RoutesData;
+
+static gboolean
+read_routes (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
+{
+    RoutesData *routes = data;
+    LobsterRoute route;
+    gboolean invalid = FALSE;
+
+    lobster_schema_read_line (&routes_schema, line, len, routes->snap, load_arena);
+    if (lobster_route_parse_line (&route, line, len, load_arena, &invalid)) {
+        route.line_no = line_no;
+        g_array_append_val (routes->routes, route);
+    } else if (invalid) {
+        fprintf (stderr, "%s:%d: not a route: %.*s\n", file, line_no, (int)len, line);
+        routes->n_invalid++;
+    }
+    return TRUE;
+}
+
+static gboolean
+same_string (const char *str, const char *old, gsize old_len)
+{
+    return strlen (str) == old_len && !strncmp (str, old, old_len);
+}
+
+static void
+parse_startmode (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    ((LobsterInterface *)record)->enabled = !STARTSWITH_LEN (value, len, "off");
+}
+
+static char *
+format_startmode (gconstpointer record, const char *old, gsize old_len)
+{
+    const LobsterInterface *iface = record;
+    if (old && !iface->enabled == STARTSWITH_LEN (old, old_len, "off")) {
+        return NULL;
+    }
+    return g_strdup (iface->enabled ? "auto" : "off");
+}
+
+static void
+parse_bootproto (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    ((LobsterInterface *)record)->dhcp = !STARTSWITH_LEN (value, len, "static");
+}
+
+static char *
+format_bootproto (gconstpointer record, const char *old, gsize old_len)
+{
+    const LobsterInterface *iface = record;
+    gboolean dhcp = !iface->enabled || iface->dhcp;
+    if (old && dhcp == !STARTSWITH_LEN (old, old_len, "static")) {
+        return NULL;
+    }
+    return g_strdup (dhcp ? "dhcp+autoip" : "static");
+}
+
+static void
+parse_ipaddr (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    LobsterInterface *iface = record;
+    gboolean had_prefix;
+
+    if (!len) {
+        iface->address.family = AF_UNSPEC;
+        iface->address_invalid = FALSE;
+    } else if (lobster_address_parse (&iface->address, value, len, &had_prefix)) {
+        iface->cidr = had_prefix;
+        iface->address_invalid = FALSE;
+    } else {
+        iface->address_invalid = TRUE;
+    }
+}
+
+static void
+set_prefix (LobsterInterface *iface, const char *value, gsize len)
+{
+    if (!len) {
+        iface->address.prefix = LOBSTER_ADDRESS_NO_PREFIX;
+        iface->subnet_invalid = FALSE;
+    } else {
+        iface->subnet_invalid = !lobster_address_parse_prefix (&iface->address, value, len);
+    }
+}
+
+static void
+parse_netmask (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    LobsterInterface *iface = record;
+
+    /* a prefix on IPADDR wins, whichever comes first */
+    if (!iface->cidr) {
+        set_prefix (iface, value, len);
+    }
+}
+
+/* a disabled or dhcp interface has its static address blanked */
+static char *
+format_static (const LobsterInterface *iface, char *value, const char *old, gsize old_len)
+{
+    if (!iface->enabled || iface->dhcp) {
+        g_free (value);
+        value = g_strdup ("");
+    }
+    if (old && same_string (value, old, old_len)) {
+        g_free (value);
+        return NULL;
+    }
+    return value;
+}
+
+static char *
+format_ipaddr (gconstpointer record, const char *old, gsize old_len)
+{
+    const LobsterInterface *iface = record;
+    return format_static (iface, lobster_address_to_string (&iface->address, iface->cidr), old, old_len);
+}
+
+static char *
+format_netmask (gconstpointer record, const char *old, gsize old_len)
+{
+    const LobsterInterface *iface = record;
+    return format_static (iface, lobster_address_prefix_to_string (&iface->address), old, old_len);
+}
+
+/* a device the interface is stacked on, for each word of value */
+static void
+parse_lower (gpointer record, const char *value, gsize len, LobsterArena *arena)
+{
+    LobsterInterface *iface = record;
+    const char *end = value + len, *word;
+    char **lower;
+    guint n = 0;
+
+    while (iface->lower && iface->lower[n]) {
+        n++;
+    }
+    for (;;) {
+        while (value < end && g_ascii_isspace (*value)) {
+            value++;
+        }
+        if (value == end) {
+            break;
+        }
+        for (word = value; value < end && !g_ascii_isspace (*value); value++)
+            ;
+        lower = lobster_arena_alloc0 (arena, (n + 2) * sizeof (char *));
+        if (n) {
+            memcpy (lower, iface->lower, n * sizeof (char *));
+        }
+        lower[n++] = lobster_arena_intern (arena, word, value - word);
+        iface->lower = lower;
+    }
+}
+
+#define IFACE_STRING(name, flags, field) \
+    { name, LOBSTER_SCHEMA_STRING, (flags), G_STRUCT_OFFSET (LobsterInterface, field) }
+#define IFACE_EXTRA(prefix, flags) \
+    { prefix, LOBSTER_SCHEMA_TABLE, LOBSTER_SCHEMA_PREFIX | (flags), G_STRUCT_OFFSET (LobsterInterface, extra) }
+
+/* indexes of the keys interface fields are written to */
+enum {
+    IFCFG_IPADDR,
+    IFCFG_NETMASK,
+    IFCFG_STARTMODE,
+    IFCFG_BOOTPROTO
+};
+
+/* keys are appended in this order when a file lacks them */
+static LobsterSchemaKey ifcfg_keys[] = {
+    { "IPADDR",    LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_APPEND, 0, parse_ipaddr,    format_ipaddr },
+    { "NETMASK",   LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_APPEND, 0, parse_netmask,   format_netmask },
+    { "STARTMODE", LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_APPEND, 0, parse_startmode, format_startmode },
+    { "BOOTPROTO", LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_APPEND, 0, parse_bootproto, format_bootproto },
+    IFACE_STRING ("MTU",             LOBSTER_SCHEMA_INTERN, mtu),
+    IFACE_STRING ("ETHTOOL_OPTIONS", 0,                     ethtool_options),
+    IFACE_STRING ("LLADDR",          0,                     lladdr),
+    /* secondary addresses */
+    IFACE_EXTRA ("IPADDR_",    0),
+    IFACE_EXTRA ("NETMASK_",   LOBSTER_SCHEMA_INTERN),
+    IFACE_EXTRA ("PREFIXLEN_", LOBSTER_SCHEMA_INTERN),
+    IFACE_EXTRA ("LABEL_",     LOBSTER_SCHEMA_INTERN),
+    /* only read; the lines are kept as they are */
+    { "ETHERDEVICE",   LOBSTER_SCHEMA_CUSTOM, 0,                     0, parse_lower, NULL },
+    { "BONDING_SLAVE", LOBSTER_SCHEMA_CUSTOM, LOBSTER_SCHEMA_PREFIX, 0, parse_lower, NULL },
+    { "BRIDGE_PORTS",  LOBSTER_SCHEMA_CUSTOM, 0,                     0, parse_lower, NULL },
+};
+
+#undef IFACE_STRING
+#undef IFACE_EXTRA
+
+static LobsterSchema ifcfg_schema = LOBSTER_SCHEMA_INIT (LOBSTER_SCHEMA_ASSIGN, '\'', ifcfg_keys);
+
+#define IFCFG_KEY(k) (G_GUINT64_CONSTANT (1) << (k))
+
+/* the keys whose value depends on the dirty fields */
+static guint64
+ifcfg_dirty_keys (const LobsterInterface *iface)
+{
+    guint dirty = iface->dirty;
+    guint64 keys = 0;
+    if (dirty & LOBSTER_INTERFACE_ADDRESS) {
+        keys |= IFCFG_KEY (IFCFG_IPADDR);
+    }
+    if (dirty & LOBSTER_INTERFACE_SUBNET) {
+        keys |= IFCFG_KEY (IFCFG_NETMASK);
+        if (iface->cidr) {
+            keys |= IFCFG_KEY (IFCFG_IPADDR);
+        }
+    }
+    if (dirty & LOBSTER_INTERFACE_ENABLED) {
+        keys |= IFCFG_KEY (IFCFG_STARTMODE);
+    }
+    /* disabled and dhcp interfaces have their static address blanked */
+    if (dirty & (LOBSTER_INTERFACE_ENABLED | LOBSTER_INTERFACE_DHCP)) {
+        keys |= IFCFG_KEY (IFCFG_BOOTPROTO) | IFCFG_KEY (IFCFG_IPADDR) | IFCFG_KEY (IFCFG_NETMASK);
+    }
+    return keys;
+}
+
+static gboolean interface_read_func (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error);
+static void     interface_loaded    (LobsterSnapshot *snap, LobsterInterface *iface);
+
+/* ifcfg files are handed to workers in shards big enough to be worth
+ * a thread */
+#define LOAD_SHARD_MIN 64
+
+typedef struct {
+    /* a single file... */
+    const char            *file;
+    gpointer               data;
+    /* ...or a shard of ifcfg files, which carries on past a file
+     * that can't be read and sets its error */
+    const char * const    *files;
+    gpointer              *datas;
+    GError               **errors;
+    guint                  n_files;
+
+    LobsterIOReadLineFunc  func;
+    GError                *error;
+} LoadTask;
+
+static void
+run_load_task (gpointer data, gpointer user_data)
+{
+    LoadTask *task = data;
+    guint i;
+
+    if (task->file) {
+        lobster_io_map_file (task->file, task->func, task->data, &task->error);
+        return;
+    }
+    for (i = 0; i < task->n_files; i++) {
+        lobster_io_map_file (task->files[i], task->func, task->datas[i], &task->errors[i]);
+    }
+}
+
+/* runs every task on a pool and waits for all of them to finish */
+static void
+run_load_tasks (LoadTask *tasks, guint n_tasks)
+{
+    GThreadPool *pool;
+    guint i;
+
+    pool = g_thread_pool_new (run_load_task, NULL, MIN (n_tasks, g_get_num_processors ()), FALSE, NULL);
+    for (i = 0; i < n_tasks; i++) {
+        if (!pool || !g_thread_pool_push (pool, &tasks[i], NULL)) {
+            run_load_task (&tasks[i], NULL);
+        }
+    }
+    if (pool) {
+        g_thread_pool_free (pool, FALSE, TRUE);
+    }
+}
+
+/*
+ * Parsed records are cached by source file; see lobstercache.c.  Bump
+ * CACHE_VERSION whenever a record layout below changes.
+ */
+#define CACHE_VERSION 6
+
+static void
+pack_string (GString *buf, const char *str)
+{
+    g_string_append_c (buf, str != NULL);
+    if (str) {
+        g_string_append_len (buf, str, strlen (str) + 1);
+    }
+}
+
+/* strings are interned in load_arena */
+static gboolean
+unpack_string (const char **p, const char *end, char **str)
+{
+    const char *nul;
+    if (*p >= end) {
+        return FALSE;
+    }
+    if (!*(*p)++) {
+        *str = NULL;
+        return TRUE;
+    }
+    nul = memchr (*p, '\0', end - *p);
+    if (!nul) {
+        return FALSE;
+    }
+    *str = lobster_arena_intern (load_arena, *p, nul - *p);
+    *p = nul + 1;
+    return TRUE;
+}
+
+static gboolean
+unpack_record_string (gconstpointer data, gsize len, char **str)
+{
+    const char *p = data;
+    return unpack_string (&p, p + len, str);
+}
+
+static void
+pack_table_entry (gpointer key, gpointer value, gpointer data)
+{
+    pack_string (data, key);
+    pack_string (data, value);
+}
+
+/* key, value pairs ended by a missing key */
+static void
+pack_table (GString *buf, GHashTable *table)
+{
+    if (table) {
+        g_hash_table_foreach (table, pack_table_entry, buf);
+    }
+    pack_string (buf, NULL);
+}
+
+static gboolean
+unpack_table (const char **p, const char *end, GHashTable **table)
+{
+    char *key, *value;
+    for (;;) {
+        if (!unpack_string (p, end, &key)) {
+            return FALSE;
+        }
+        if (!key) {
+            return TRUE;
+        }
+        if (!unpack_string (p, end, &value) || !value) {
+            return FALSE;
+        }
+        if (!*table) {
+            *table = g_hash_table_new (g_str_hash, g_str_equal);
+        }
+        g_hash_table_replace (*table, key, value);
+    }
+}
+
+/* strings ended by a missing one; NULL stays NULL */
+static void
+pack_strv (GString *buf, char **strv)
+{
+    while (strv && *strv) {
+        pack_string (buf, *strv++);
+    }
+    pack_string (buf, NULL);
+}
+
+static gboolean
+unpack_strv (const char **p, const char *end, char ***strv)
+{
+    GPtrArray *strings = g_ptr_array_new ();
+    char *str;
+
+    for (;;) {
+        if (!unpack_string (p, end, &str)) {
+            g_ptr_array_free (strings, TRUE);
+            return FALSE;
+        }
+        if (!str) {
+            break;
+        }
+        g_ptr_array_add (strings, str);
+    }
+    *strv = NULL;
+    if (strings->len) {
+        g_ptr_array_add (strings, NULL);
+        *strv = lobster_arena_alloc0 (load_arena, strings->len * sizeof (char *));
+        memcpy (*strv, strings->pdata, strings->len * sizeof (char *));
+    }
+    g_ptr_array_free (strings, TRUE);
+    return TRUE;
+}
+
+static void
+pack_interface (GString *buf, LobsterInterface *iface)
+{
+    g_string_append_c (buf, iface->enabled | iface->dhcp << 1 | iface->cidr << 2 |
+                       iface->address_invalid << 3 | iface->subnet_invalid << 4);
+    g_string_append_len (buf, (const char *)&iface->address, sizeof (iface->address));
+    pack_string (buf, iface->mtu);
+    pack_string (buf, iface->ethtool_options);
+    pack_string (buf, iface->lladdr);
+    pack_table (buf, iface->extra);
+    pack_strv (buf, iface->lower);
+}
+
+static gboolean
+unpack_interface (const char *p, gsize len, LobsterInterface *iface)
+{
+    const char *end = p + len;
+    if (len < 1 + sizeof (iface->address)) {
+        return FALSE;
+    }
+    iface->enabled = *p & 1;
+    iface->dhcp = *p >> 1 & 1;
+    iface->cidr = *p >> 2 & 1;
+    iface->address_invalid = *p >> 3 & 1;
+    iface->subnet_invalid = *p >> 4 & 1;
+    p++;
+    memcpy (&iface->address, p, sizeof (iface->address));
+    p += sizeof (iface->address);
+    return unpack_string (&p, end, &iface->mtu) && unpack_string (&p, end, &iface->ethtool_options) &&
+        unpack_string (&p, end, &iface->lladdr) && unpack_table (&p, end, &iface->extra) &&
+        unpack_strv (&p, end, &iface->lower);
+}
+
+static void
+pack_routes (GString *buf, const RoutesData *routes)
+{
+    const LobsterRoute *route;
+    guint32 n[2] = { routes->routes->len, routes->n_invalid };
+    guint i;
+
+    g_string_append_len (buf, (const char *)n, sizeof (n));
+    for (i = 0; i < routes->routes->len; i++) {
+        route = &g_array_index (routes->routes, LobsterRoute, i);
+        g_string_append_len (buf, (const char *)&route->destination, sizeof (route->destination));
+        g_string_append_len (buf, (const char *)&route->gateway, sizeof (route->gateway));
+        g_string_append_len (buf, (const char *)&route->line_no, sizeof (route->line_no));
+        pack_string (buf, route->device);
+        pack_string (buf, route->options);
+    }
+}
+
+static gboolean
+unpack_routes (const char **p, const char *end, RoutesData *routes)
+{
+    const gsize fixed = 2 * sizeof (LobsterAddress) + sizeof (guint);
+    LobsterRoute route;
+    guint32 n[2];
+    guint i;
+
+    if (end - *p < (gssize)sizeof (n)) {
+        return FALSE;
+    }
+    memcpy (n, *p, sizeof (n));
+    *p += sizeof (n);
+    routes->n_invalid = n[1];
+    for (i = 0; i < n[0]; i++) {
+        if (end - *p < (gssize)fixed) {
+            return FALSE;
+        }
+        memcpy (&route.destination, *p, sizeof (route.destination));
+        *p += sizeof (route.destination);
+        memcpy (&route.gateway, *p, sizeof (route.gateway));
+        *p += sizeof (route.gateway);
+        memcpy (&route.line_no, *p, sizeof (route.line_no));
+        *p += sizeof (route.line_no);
+        if (!unpack_string (p, end, &route.device) || !unpack_string (p, end, &route.options)) {
+            return FALSE;
+        }
+        g_array_append_val (routes->routes, route);
+    }
+    return TRUE;
+}
+
+/* the default route's gateway, then the table */
+static gboolean
+unpack_routes_record (gconstpointer data, gsize len, char **router, RoutesData *routes)
+{
+    const char *p = data;
+    return unpack_string (&p, p + len, router) && unpack_routes (&p, (const char *)data + len, routes);
+}
+
+/* stats source and fills in a record from the cache if it is still
+ * valid; *have_st says whether st can be used to store a new record */
+static gboolean
+cache_lookup (LobsterCache *cache, const char *source, struct stat *st, gboolean *have_st,
+              gconstpointer *data, gsize *len)
+{
+    *have_st = stat (source, st) == 0;
+    return *have_st && lobster_cache_lookup (cache, source, st, data, len);
+}
+
+static void
+cache_store (LobsterCache *cache, const char *source, const struct stat *st, GString *record)
+{
+    lobster_cache_store (cache, source, st, record->str, record->len);
+    g_string_truncate (record, 0);
+}
+
+/* the ifcfg file for a device */
+static char *
+ifcfg_path (LobsterArena *arena, const char *interface)
+{
+    gsize len = strlen (interface);
+    char *path = lobster_arena_alloc0 (arena, sizeof (NETWORK_IFCFG "-") + len);
+    memcpy (path, NETWORK_IFCFG "-", sizeof (NETWORK_IFCFG "-") - 1);
+    memcpy (path + sizeof (NETWORK_IFCFG "-") - 1, interface, len);
+    return path;
+}
+
+/*
+ * Undo history.  A step keeps what one edit changed, as it was before
+ * and after, so moving through the history copies nothing but that
+ * and the chunk it sits in.  Interface versions are shared with the
+ * snapshots they came from, and system versions hold the arena their
+ * strings live in; the history is dropped whenever the devices are
+ * reloaded.
+ */
+#define HISTORY_MAX         100
+/* edits to the same thing this close together undo as one */
+#define HISTORY_MERGE_USEC  G_USEC_PER_SEC
+#define HISTORY_SYSTEM      G_MAXUINT
+
+typedef struct {
+    LobsterArena          *arena;   /* a reference to the snapshot's system_arena */
+    const LobsterResolver *resolver;
+    char                  *router;
+    gboolean               use_nm;
+} SystemVersion;
+
+typedef struct {
+    guint             index;            /* of the interface, or HISTORY_SYSTEM */
+    LobsterInterface *iface[2];         /* before and after */
+    SystemVersion     system[2];
+    gint64            time;
+} HistoryStep;
+
+static GArray *history;                 /* of HistoryStep, oldest first */
+static guint   history_pos;             /* steps that are done */
+
+static void
+history_step_clear (HistoryStep *step)
+{
+    lobster_interface_unref (step->iface[0]);
+    lobster_interface_unref (step->iface[1]);
+    lobster_arena_unref (step->system[0].arena);
+    lobster_arena_unref (step->system[1].arena);
+}
+
+static void
+history_truncate (guint len)
+{
+    guint i;
+    for (i = len; history && i < history->len; i++) {
+        history_step_clear (&g_array_index (history, HistoryStep, i));
+    }
+    if (history && len < history->len) {
+        g_array_set_size (history, len);
+    }
+    history_pos = MIN (history_pos, len);
+}
+
+/* takes a reference for whoever gets version->arena */
+static void
+system_version_hold (const SystemVersion *version)
+{
+    if (version->arena) {
+        lobster_arena_ref (version->arena);
+    }
+}
+
+static void
+system_version (SystemVersion *version, const LobsterSnapshot *snap)
+{
+    version->arena = snap->system_arena;
+    system_version_hold (version);
+    version->resolver = snap->resolver;
+    version->router = snap->router;
+    version->use_nm = snap->use_nm;
+}
+
+/* records an edit of the interface at index, or of the system fields,
+ * that took published from before to after; takes no references */
+static void
+history_record (guint index, LobsterSnapshot *before, LobsterSnapshot *after)
+{
+    gint64 now = g_get_monotonic_time ();
+    HistoryStep *last, step = { 0 };
+
+    if (!history) {
+        history = g_array_new (FALSE, FALSE, sizeof (HistoryStep));
+    }
+    /* a new edit forgets what was undone */
+    history_truncate (history_pos);
+
+    last = history_pos ? &g_array_index (history, HistoryStep, history_pos - 1) : NULL;
+    if (last && last->index == index && now - last->time < HISTORY_MERGE_USEC) {
+        if (index != HISTORY_SYSTEM) {
+            lobster_interface_unref (last->iface[1]);
+            last->iface[1] = lobster_interface_ref (lobster_snapshot_get_nth (after, index));
+        } else {
+            lobster_arena_unref (last->system[1].arena);
+            system_version (&last->system[1], after);
+        }
+        last->time = now;
+        return;
+    }
+
+    step.index = index;
+    step.time = now;
+    if (index != HISTORY_SYSTEM) {
+        step.iface[0] = lobster_interface_ref (lobster_snapshot_get_nth (before, index));
+        step.iface[1] = lobster_interface_ref (lobster_snapshot_get_nth (after, index));
+    } else {
+        system_version (&step.system[0], before);
+        system_version (&step.system[1], after);
+    }
+
+    if (history->len == HISTORY_MAX) {
+        history_step_clear (&g_array_index (history, HistoryStep, 0));
+        g_array_remove_index (history, 0);
+    }
+    g_array_append_val (history, step);
+    history_pos = history->len;
+}
+
+/* puts back one side of a step; what it is diffed against is whatever
+ * was saved last, which may be newer than the step */
+static void
+history_apply (const HistoryStep *step, int side)
+{
+    LobsterSnapshot *draft = snapshot_draft ();
+    LobsterInterface *iface;
+
+    if (step->index != HISTORY_SYSTEM) {
+        iface = interface_copy (snapshot_edits (draft), step->iface[side]);
+        iface->saved = lobster_snapshot_get_nth (draft, step->index)->saved;
+        iface->dirty = interface_diff (iface);
+        snapshot_set_interface (draft, iface);
+    } else {
+        system_version_hold (&step->system[side]);
+        lobster_arena_unref (draft->system_arena);
+        draft->system_arena = step->system[side].arena;
+        draft->resolver = step->system[side].resolver;
+        draft->router = step->system[side].router;
+        draft->use_nm = step->system[side].use_nm;
+        draft->dirty = system_diff (draft);
+    }
+    snapshot_publish (draft);
+
+    /* show what changed */
+    lobster_ignore_edits ();
+    if (step->index != HISTORY_SYSTEM) {
+        columns_update (iface);
+        gtk_combo_box_set_active (GTK_COMBO_BOX (WIDGET ("connection_list")), step->index);
+    } else {
+        TOGGLED ("nm_toggle", draft->use_nm);
+    }
+    lobster_accept_edits ();
+    lobster_interface_display_selected ();
+    lobster_is_valid ();
+}
+
+gboolean
+lobster_undo (void)
+{
+    if (!history_pos) {
+        return FALSE;
+    }
+    history_pos--;
+    history_apply (&g_array_index (history, HistoryStep, history_pos), 0);
+    return TRUE;
+}
+
+gboolean
+lobster_redo (void)
+{
+    if (!history || history_pos == history->len) {
+        return FALSE;
+    }
+    history_apply (&g_array_index (history, HistoryStep, history_pos), 1);
+    history_pos++;
+    return TRUE;
+}
+
+/* reads the ifcfg files of ifaces, fresh records in load_arena, from
+ * the cache where it can; errors[i] is set if ifaces[i] couldn't be
+ * read, and error is a copy of the first of those */
+static gboolean
+load_interfaces (LobsterCache *cache, LobsterInterface **ifaces, guint n, GError **errors, GError **error)
+{
+    LobsterArena *paths;
+    LobsterInterface *iface;
+    LoadTask *tasks;
+    GString *record;
+    char **files;
+    char **miss_files;
+    gpointer *miss_ifaces;
+    GError **miss_errors;
+    struct stat *sts;
+    gboolean *have_sts;
+    gboolean *misses;
+    gconstpointer data;
+    gsize len;
+    gboolean ret = TRUE;
+    guint n_misses, n_shards, shard_size;
+    guint i;
+
+    /* only files that changed since they were cached get parsed */
+    paths = lobster_arena_new ();
+    files = g_new (char *, n);
+    sts = g_new (struct stat, n);
+    have_sts = g_new (gboolean, n);
+    misses = g_new (gboolean, n);
+    miss_files = g_new (char *, n);
+    miss_ifaces = g_new (gpointer, n);
+    miss_errors = g_new0 (GError *, n);
+    n_misses = 0;
+    for (i = 0; i < n; i++) {
+        iface = ifaces[i];
+        errors[i] = NULL;
+        files[i] = ifcfg_path (paths, iface->interface);
+
+        misses[i] = !cache_lookup (cache, files[i], &sts[i], &have_sts[i], &data, &len) ||
+            !unpack_interface (data, len, iface);
+        if (misses[i]) {
+            iface->enabled = iface->dhcp = iface->cidr = FALSE;
+            iface->address_invalid = iface->subnet_invalid = FALSE;
+            lobster_address_clear (&iface->address);
+            lobster_schema_clear (&ifcfg_schema, iface, load_arena);
+            miss_files[n_misses] = files[i];
+            miss_ifaces[n_misses] = iface;
+            n_misses++;
+        }
+    }
+
+    /* shards of about the same size, one or so per processor */
+    shard_size = MAX (LOAD_SHARD_MIN, (n_misses + g_get_num_processors () - 1) / g_get_num_processors ());
+    n_shards = (n_misses + shard_size - 1) / shard_size;
+    tasks = g_new0 (LoadTask, n_shards);
+    for (i = 0; i < n_shards; i++) {
+        tasks[i].files = (const char * const *)miss_files + i * shard_size;
+        tasks[i].datas = miss_ifaces + i * shard_size;
+        tasks[i].errors = miss_errors + i * shard_size;
+        tasks[i].n_files = MIN (shard_size, n_misses - i * shard_size);
+        tasks[i].func = interface_read_func;
+    }
+
+    if (n_misses) {
+        fprintf (stderr, "parsing %u of %u ifcfg files\n", n_misses, n);
+    }
+    run_load_tasks (tasks, n_shards);
+
+    /* in device order, so that the error reported is always the one
+     * a sequential load would have hit first */
+    record = g_string_new (NULL);
+    for (i = 0, n_misses = 0; i < n; i++) {
+        if (misses[i] && (errors[i] = miss_errors[n_misses++])) {
+            if (ret) {
+                g_propagate_error (error, g_error_copy (errors[i]));
+                ret = FALSE;
+            }
+        } else if (misses[i] && have_sts[i]) {
+            pack_interface (record, ifaces[i]);
+            cache_store (cache, files[i], &sts[i], record);
+        }
+    }
+    g_string_free (record, TRUE);
+
+    lobster_arena_unref (paths);
+    g_free (files);
+    g_free (sts);
+    g_free (have_sts);
+    g_free (misses);
+    g_free (miss_files);
+    g_free (miss_ifaces);
+    g_free (miss_errors);
+    g_free (tasks);
+
+    return ret;
+}
+
+/*
+ * The devices are loaded up front but their ifcfg files only when
+ * needed: the one on show when it is shown, the rest from an idle
+ * handler, and all of them before anything that works on the whole
+ * model.  Until then a snapshot holds a stand-in that only has the
+ * name.  The cache stays open meanwhile, since writing it drops the
+ * entries that weren't looked up.
+ */
+#define PREFETCH_BATCH 32
+
+static LobsterCache *lazy_cache;
+static guint         lazy_remaining;
+static guint         prefetch_id;
+static guint         prefetch_next;
+
+/* the cache is only written once every interface has been looked up */
+static void
+lazy_finish (void)
+{
+    GError *error = NULL;
+
+    if (prefetch_id) {
+        g_source_remove (prefetch_id);
+        prefetch_id = 0;
+    }
+    if (!lazy_cache) {
+        return;
+    }
+    if (!lazy_remaining && !lobster_cache_write (lazy_cache, &error)) {
+        fprintf (stderr, "could not write cache: %s\n", error->message);
+        g_error_free (error);
+    }
+    lobster_cache_free (lazy_cache);
+    lazy_cache = NULL;
+}
+
+/* loads the stand-ins at indexes into a new generation; those that
+ * can't be read are published too, with the reason, so that they
+ * aren't read again each time the whole model is needed */
+static gboolean
+load_lazy (const guint *indexes, guint n, GError **error)
+{
+    LobsterArena *arena = published->arena;
+    LobsterInterface **ifaces = g_new (LobsterInterface *, n);
+    GError **errors = g_new (GError *, n);
+    LobsterInterface *stub;
+    LobsterSnapshot *draft;
+    gboolean ret;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        stub = lobster_snapshot_get_nth (published, indexes[i]);
+        ifaces[i] = interface_new (arena, stub->interface);
+        ifaces[i]->index = stub->index;
+        ifaces[i]->loaded = TRUE;
+    }
+
+    load_arena = arena;
+    ret = load_interfaces (lazy_cache, ifaces, n, errors, error);
+    load_arena = NULL;
+
+    draft = snapshot_draft ();
+    for (i = 0; i < n; i++) {
+        if (errors[i]) {
+            lobster_interface_unref (ifaces[i]);
+            stub = interface_copy (snapshot_edits (draft), lobster_snapshot_get_nth (draft, indexes[i]));
+            stub->load_error = lobster_arena_strndup (snapshot_edits (draft), errors[i]->message,
+                                                      strlen (errors[i]->message));
+            snapshot_set_interface (draft, stub);
+            g_error_free (errors[i]);
+        } else {
+            snapshot_set_interface (draft, ifaces[i]);
+            interface_loaded (draft, ifaces[i]);
+            lazy_remaining--;
+        }
+    }
+    snapshot_publish (draft);
+    if (!lazy_remaining) {
+        lazy_finish ();
+    }
+    g_free (ifaces);
+    g_free (errors);
+
+    return ret;
+}
+
+static gboolean
+prefetch (gpointer data)
+{
+    guint indexes[PREFETCH_BATCH];
+    GError *error = NULL;
+    guint n = 0;
+
+    for (; prefetch_next < lobster_interface_count () && n < PREFETCH_BATCH; prefetch_next++) {
+        if (!lobster_interface_get_nth (prefetch_next)->loaded &&
+            !lobster_interface_get_nth (prefetch_next)->load_error) {
+            indexes[n++] = prefetch_next;
+        }
+    }
+    /* a failure is left for whatever needs the interface to report */
+    if (n && !load_lazy (indexes, n, &error)) {
+        fprintf (stderr, "prefetch: %s\n", error->message);
+        g_error_free (error);
+    }
+    if (lazy_remaining && prefetch_next < lobster_interface_count ()) {
+        return TRUE;
+    }
+    prefetch_id = 0;
+    return FALSE;
+}
+
+gboolean
+lobster_system_ensure_loaded (GError **error)
+{
+    guint *indexes;
+    guint i, n = 0;
+    gboolean ret;
+
+    if (!lazy_remaining) {
+        return TRUE;
+    }
+    indexes = g_new (guint, lazy_remaining);
+    for (i = 0; i < lobster_interface_count (); i++) {
+        if (!lobster_interface_get_nth (i)->loaded && !lobster_interface_get_nth (i)->load_error) {
+            indexes[n++] = i;
+        }
+    }
+    ret = !n || load_lazy (indexes, n, error);
+    g_free (indexes);
+
+    /* one that failed before is only read again when it is shown */
+    for (i = 0; ret && i < lobster_interface_count (); i++) {
+        if (lobster_interface_get_nth (i)->load_error) {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s",
+                         lobster_interface_get_nth (i)->load_error);
+            ret = FALSE;
+        }
+    }
+    return ret;
+}
+
+static gboolean
+interface_ensure_loaded (LobsterInterface *iface, GError **error)
+{
+    return iface->loaded || load_lazy (&iface->index, 1, error);
+}
+
+gboolean
+lobster_system_load_devices (GError **error)
+{
+    LobsterCache *cache;
+    LobsterSnapshot *snap;
+    LobsterArena *arena;
+    GPtrArray *devices;
+    GString *servers;
+    GString *record;
+    LobsterInterface *iface;
+    LoadTask tasks[3];
+    struct stat sys_st[3];
+    gboolean sys_have_st[3];
+    gboolean sys_miss[3];
+    gconstpointer data;
+    gsize len;
+    char *str;
+    LobsterSnapshot sys = { 0 };
+    RoutesData routes = { &sys, NULL, 0 };
+    gboolean ret = TRUE;
+    guint n_tasks = 0;
+    guint i;
+
+    /* finish or undo a save that was interrupted */
+    if (!lobster_io_transaction_recover (NETWORK_JOURNAL, error)) {
+        return FALSE;
+    }
+
+    /* everything read becomes the next generation, which replaces the
+     * current one whole once it has loaded */
+    arena = load_arena = lobster_arena_new ();
+
+    devices = g_ptr_array_new ();
+    if (!lobster_io_map_file (NET_DEVICES, read_net_devices, devices, error)) {
+        g_ptr_array_free (devices, TRUE);
+        lobster_arena_unref (arena);
+        load_arena = NULL;
+        return FALSE;
+    }
+
+    cache = lobster_cache_open (LOBSTER_CACHE_FILE, CACHE_VERSION);
+    memset (tasks, 0, sizeof (tasks));
+
+    servers = g_string_new (NULL);
+    sys_miss[0] = !cache_lookup (cache, RESOLV_CONF, &sys_st[0], &sys_have_st[0], &data, &len) ||
+        !unpack_record_string (data, len, &str) || !str;
+    if (sys_miss[0]) {
+        tasks[n_tasks].file = RESOLV_CONF;
+        tasks[n_tasks].func = read_resolv_conf;
+        tasks[n_tasks].data = servers;
+        n_tasks++;
+    } else {
+        g_string_assign (servers, str);
+    }
+
+    routes.routes = g_array_new (FALSE, FALSE, sizeof (LobsterRoute));
+    sys_miss[1] = !cache_lookup (cache, NETWORK_ROUTES, &sys_st[1], &sys_have_st[1], &data, &len) ||
+        !unpack_routes_record (data, len, &sys.router, &routes);
+    if (sys_miss[1]) {
+        sys.router = NULL;
+        g_array_set_size (routes.routes, 0);
+        routes.n_invalid = 0;
+        tasks[n_tasks].file = NETWORK_ROUTES;
+        tasks[n_tasks].func = read_routes;
+        tasks[n_tasks].data = &routes;
+        n_tasks++;
+    }
+
+    sys_miss[2] = !cache_lookup (cache, NETWORK_CONFIG, &sys_st[2], &sys_have_st[2], &data, &len) || len != 1;
+    if (sys_miss[2]) {
+        tasks[n_tasks].file = NETWORK_CONFIG;
+        tasks[n_tasks].func = read_config;
+        tasks[n_tasks].data = &sys;
+        n_tasks++;
+    } else {
+        sys.use_nm = *(const char *)data;
+    }
+
+    fprintf (stderr, "%u devices, parsing %u system files\n", devices->len, n_tasks);
+    run_load_tasks (tasks, n_tasks);
+
+    for (i = 0; i < n_tasks; i++) {
+        if (tasks[i].error) {
+            if (ret) {
+                g_propagate_error (error, tasks[i].error);
+                ret = FALSE;
+            } else {
+                g_error_free (tasks[i].error);
+            }
+        }
+    }
+
+    if (ret) {
+        record = g_string_new (NULL);
+        if (sys_miss[0] && sys_have_st[0]) {
+            pack_string (record, servers->str);
+            cache_store (cache, RESOLV_CONF, &sys_st[0], record);
+        }
+        if (sys_miss[1] && sys_have_st[1]) {
+            pack_string (record, sys.router);
+            pack_routes (record, &routes);
+            cache_store (cache, NETWORK_ROUTES, &sys_st[1], record);
+        }
+        if (sys_miss[2] && sys_have_st[2]) {
+            g_string_append_c (record, sys.use_nm);
+            cache_store (cache, NETWORK_CONFIG, &sys_st[2], record);
+        }
+        g_string_free (record, TRUE);
+
+        snap = snapshot_new (arena);
+
+        /* snap->chunks, with stand-ins */
+        for (i = 0; interfaces_by_id && i < interfaces_by_id->len; i++) {
+            g_array_index (interfaces_by_id, guint, i) = 0;
+        }
+        if (column_flags) {
+            g_array_set_size (column_addresses, 0);
+            g_byte_array_set_size (column_flags, 0);
+        }
+        lobster_trie_free (column_trie);
+        column_trie = NULL;
+        for (i = 0; i < devices->len; i++) {
+            iface = interface_new (arena, g_ptr_array_index (devices, i));
+            snapshot_append_interface (snap, iface);
+            interface_assign_id (iface);
+            columns_update (iface);
+        }
+
+        /* snap->resolver */
+        snap->resolver = lobster_resolver_parse (servers->str, servers->len, FALSE, NULL, arena);
+        fprintf (stderr, "have %u nameservers\n", snap->resolver->n_servers);
+
+        /* snap->routes */
+        snap->routes = lobster_route_table_new ((LobsterRoute *)routes.routes->data, routes.routes->len,
+                                                routes.n_invalid, arena);
+        fprintf (stderr, "%u routes\n", snap->routes->n_routes);
+
+        /* snap->router */
+        snap->router = sys.router;
+        fprintf (stderr, "router: %s\n", snap->router);
+
+        /* snap->use_nm */
+        snap->use_nm = sys.use_nm;
+
+        /* the old generation goes once nothing holds it, and edits
+         * to it can no longer be undone */
+        history_truncate (0);
+        lobster_snapshot_unref (saved_snapshot);
+        saved_snapshot = lobster_snapshot_ref (snap);
+        snapshot_publish (snap);
+
+        /* a load still under way is given up, cache and all */
+        lazy_remaining = G_MAXUINT;
+        lazy_finish ();
+        lazy_cache = cache;
+        lazy_remaining = devices->len;
+        if (lazy_remaining) {
+            prefetch_next = 0;
+            prefetch_id = g_idle_add_full (G_PRIORITY_LOW, prefetch, NULL, NULL);
+        } else {
+            lazy_finish ();
+        }
+    } else {
+        lobster_cache_free (cache);
+        lobster_arena_unref (arena);
+    }
+    load_arena = NULL;
+
+    g_string_free (servers, TRUE);
+    g_array_free (routes.routes, TRUE);
+    g_ptr_array_free (devices, TRUE);
+
+    return ret;
+}
+
+gboolean
+lobster_system_load (GError **error)
+{
+    return lobster_system_load_devices (error) && lobster_system_ensure_loaded (error);
+}
+
+/*
+ * An apply runs only what the save changed: the interfaces that are
+ * dirty go down and back up, along with the ones stacked on them,
+ * routes not tied to one of those are added again, and cached lookups
+ * are dropped if the resolver changed.  A change of who manages the
+ * network still restarts it.
+ *
+ * Where only a static address moved, and for the router, the kernel
+ * is told directly instead, make-before-break: the new addresses are
+ * added, the routes replaced, and only then are the old addresses
+ * deleted, all in one netlink batch.  Connections that can survive
+ * the change do.  If the batch fails the commands it stood for run.
+ *
+ * The commands are tasks in a graph: a device goes down only after
+ * the ones stacked on it have, and comes up only after the ones it is
+ * stacked on have.  Tasks that don't wait on each other run at once.
+ */
+typedef struct _ApplyRun ApplyRun;
+
+typedef enum {
+    TASK_WAITING,
+    TASK_RUNNING,
+    TASK_DONE
+} TaskState;
+
+typedef struct {
+    char      **argv;
+    gboolean    fallback;       /* stands for part of the batch */
+    guint       waiting;        /* tasks to finish before this starts */
+    GArray     *then;           /* of the indexes of tasks waiting on this */
+    guint       up;             /* for an ifdown, the ifup after it, or NO_TASK */
+    gboolean    owed;           /* an ifup whose device has been taken down */
+
+    TaskState   state;
+    gboolean    stopped;        /* by a timeout or Cancel, which set the error */
+    ApplyRun   *run;
+    GPid        pid;
+    GIOChannel *output[2];      /* stdout and stderr */
+    guint       output_id[2];
+    GString    *partial;        /* output since the last newline */
+    guint       timeout_id;
+} ApplyTask;
+
+typedef struct {
+    GArray              *tasks;         /* of ApplyTask */
+    LobsterNetlinkBatch *batch;         /* sent before the tasks start */
+    GArray              *expect;        /* of ApplyExpect, checked once done */
+} ApplyPlan;
+
+/* an address a device should have once the apply is done */
+typedef struct {
+    char           *device;
+    LobsterAddress  address;
+} ApplyExpect;
+
+#define NO_TASK G_MAXUINT
+
+static guint
+apply_add (ApplyPlan *plan, gboolean fallback, const char *program, const char *arg, const char *arg2)
+{
+    ApplyTask task = { NULL };
+
+    task.argv = g_new0 (char *, 4);
+    task.argv[0] = g_strdup (program);
+    task.argv[1] = g_strdup (arg);
+    task.argv[2] = g_strdup (arg2);
+    task.fallback = fallback;
+    task.then = g_array_new (FALSE, FALSE, sizeof (guint));
+    task.up = NO_TASK;
+    g_array_append_val (plan->tasks, task);
+    return plan->tasks->len - 1;
+}
+
+/* task then starts only once first is done */
+static void
+apply_after (ApplyPlan *plan, guint first, guint then)
+{
+    if (first == NO_TASK || then == NO_TASK) {
+        return;
+    }
+    g_array_append_val (g_array_index (plan->tasks, ApplyTask, first).then, then);
+    g_array_index (plan->tasks, ApplyTask, then).waiting++;
+}
+
+static gboolean
+static_address (const LobsterInterface *iface)
+{
+    return iface->enabled && !iface->dhcp && !iface->address_invalid && !iface->subnet_invalid &&
+        iface->address.family != AF_UNSPEC && iface->address.prefix != LOBSTER_ADDRESS_NO_PREFIX;
+}
+
+/* a route the kernel can be given as it is written */
+static gboolean
+plain_route (const LobsterRoute *route)
+{
+    return !route->options && route->destination.prefix != LOBSTER_ADDRESS_NO_PREFIX;
+}
+
+/* whether the interface only changed its static IPv4 address, every
+ * route through it can be put back over netlink, and nothing is
+ * stacked on it; a new IPv6 address is tentative until duplicate
+ * detection is done, so swapping one in would leave the interface
+ * without a usable address */
+static gboolean
+interface_hitless (LobsterSnapshot *snap, const LobsterInterface *iface)
+{
+    guint i;
+
+    if (iface->dirty & ~(LOBSTER_INTERFACE_ADDRESS | LOBSTER_INTERFACE_SUBNET) ||
+        !iface->saved || !static_address (iface) || !static_address (iface->saved) ||
+        iface->address.family != AF_INET || iface->saved->address.family != AF_INET) {
+        return FALSE;
+    }
+    for (i = 0; snap->routes && i < snap->routes->n_routes; i++) {
+        const LobsterRoute *route = &snap->routes->routes[i];
+        if (route->device && !strcmp (route->device, iface->interface) &&
+            route->destination.prefix && !plain_route (route)) {
+            return FALSE;
+        }
+    }
+    /* if the batch fails the fallback restarts iface, which would take
+     * down whatever is stacked on it */
+    for (i = 0; i < snap->n_interfaces; i++) {
+        char **lower = lobster_snapshot_get_nth (snap, i)->lower;
+        for (; lower && *lower; lower++) {
+            if (!strcmp (*lower, iface->interface)) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* the routes through iface, which the kernel drops along with an
+ * address whose subnet held their gateway */
+static gboolean
+plan_routes (LobsterNetlinkBatch *batch, const LobsterSnapshot *snap, const LobsterInterface *iface, GError **error)
+{
+    guint i;
+
+    for (i = 0; snap->routes && i < snap->routes->n_routes; i++) {
+        const LobsterRoute *route = &snap->routes->routes[i];
+        /* the default route is the router's */
+        if (!route->device || strcmp (route->device, iface->interface) || !route->destination.prefix) {
+            continue;
+        }
+        if (!lobster_netlink_replace_route (batch, &route->destination, &route->gateway, route->device, error)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* the default route through the router, on the device the routes
+ * file gives it if any */
+static gboolean
+plan_router (LobsterNetlinkBatch *batch, const LobsterSnapshot *snap, GError **error)
+{
+    LobsterAddress router, destination;
+    const char *device = NULL;
+    guint i;
+
+    lobster_address_clear (&router);
+    if (!snap->router || !lobster_address_parse (&router, snap->router, strlen (snap->router), NULL)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s: %s", snap->router ? snap->router : "",
+                     _("not an address"));
+        return FALSE;
+    }
+    for (i = 0; snap->routes && i < snap->routes->n_routes; i++) {
+        const LobsterRoute *route = &snap->routes->routes[i];
+        if (!route->destination.prefix && route->destination.family == router.family) {
+            device = route->device;
+            break;
+        }
+    }
+    lobster_address_clear (&destination);
+    destination.family = router.family;
+    destination.prefix = 0;
+    return lobster_netlink_replace_route (batch, &destination, &router, device, error);
+}
+
+/* the index of a device iface is stacked on, or -1 if it isn't one of
+ * ours */
+static int
+lower_index (LobsterSnapshot *snap, const char *device)
+{
+    LobsterInterface *lower = lobster_snapshot_get_from_device (snap, device);
+    return lower ? (int)lower->index : -1;
+}
+
+/* restarts the enabled interfaces stacked on ones that restart */
+static void
+plan_restart_upper (LobsterSnapshot *snap, gboolean *restart)
+{
+    const LobsterInterface *iface;
+    gboolean changed = TRUE;
+    guint i;
+    int j;
+    char **lower;
+
+    while (changed) {
+        changed = FALSE;
+        for (i = 0; i < snap->n_interfaces; i++) {
+            iface = lobster_snapshot_get_nth (snap, i);
+            if (restart[i] || !iface->enabled) {
+                continue;
+            }
+            for (lower = iface->lower; lower && *lower; lower++) {
+                if ((j = lower_index (snap, *lower)) >= 0 && restart[j]) {
+                    restart[i] = changed = TRUE;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/* what snap changed since it was last saved */
+static void
+apply_plan (LobsterSnapshot *snap, ApplyPlan *plan)
+{
+    const LobsterInterface *iface;
+    guint n = snap->n_interfaces;
+    gboolean *restart = g_new0 (gboolean, n);
+    gboolean *hitless = g_new0 (gboolean, n);
+    guint *down = g_new (guint, n);
+    guint *up = g_new (guint, n);
+    gboolean every_device = n > 0;
+    guint route = NO_TASK;
+    GError *error = NULL;
+    char **lower;
+    guint i;
+    int j;
+
+    plan->tasks = g_array_new (FALSE, FALSE, sizeof (ApplyTask));
+    plan->batch = lobster_netlink_batch_new ();
+    plan->expect = g_array_new (FALSE, FALSE, sizeof (ApplyExpect));
+
+    if (snap->dirty & LOBSTER_SYSTEM_USE_NM) {
+        apply_add (plan, FALSE, SERVICE, "network", "restart");
+        goto out;
+    }
+
+    /* which interfaces restart is settled before what is stacked on
+     * them is added, as is an address that can't go in the batch */
+    for (i = 0; i < n; i++) {
+        iface = lobster_snapshot_get_nth (snap, i);
+        if (!iface->dirty) {
+            continue;
+        }
+        if (interface_hitless (snap, iface) &&
+            lobster_netlink_add_address (plan->batch, iface->interface, &iface->address, &error)) {
+            hitless[i] = TRUE;
+            continue;
+        }
+        if (error) {
+            fprintf (stderr, "%s\n", error->message);
+            g_clear_error (&error);
+        }
+        restart[i] = TRUE;
+    }
+    plan_restart_upper (snap, restart);
+
+    for (i = 0; i < n; i++) {
+        iface = lobster_snapshot_get_nth (snap, i);
+        /* stacked on one that restarts; the address it got in the
+         * batch is the one ifup gives it anyway */
+        hitless[i] &= !restart[i];
+        every_device &= restart[i];
+        if ((restart[i] || hitless[i]) && static_address (iface)) {
+            ApplyExpect expect = { g_strdup (iface->interface), iface->address };
+            g_array_append_val (plan->expect, expect);
+        }
+
+        down[i] = up[i] = NO_TASK;
+        if (restart[i] || hitless[i]) {
+            down[i] = apply_add (plan, hitless[i], IFDOWN, iface->interface, NULL);
+            if (iface->enabled) {
+                up[i] = apply_add (plan, hitless[i], IFUP, iface->interface, NULL);
+                apply_after (plan, down[i], up[i]);
+                g_array_index (plan->tasks, ApplyTask, down[i]).up = up[i];
+            }
+        }
+    }
+
+    /* down from the top of a stack, and up from the bottom */
+    for (i = 0; i < n; i++) {
+        iface = lobster_snapshot_get_nth (snap, i);
+        for (lower = iface->lower; down[i] != NO_TASK && lower && *lower; lower++) {
+            if ((j = lower_index (snap, *lower)) >= 0 && j != i) {
+                apply_after (plan, down[i], down[j]);
+                apply_after (plan, up[j], up[i]);
+                /* a disabled lower has no ifup to wait on */
+                apply_after (plan, down[j], up[i]);
+            }
+        }
+    }
+
+    /* ifup brings up a device's routes with it */
+    if ((snap->dirty & LOBSTER_SYSTEM_ROUTER) && !every_device) {
+        if (plan_router (plan->batch, snap, &error)) {
+            route = apply_add (plan, TRUE, IFUP_ROUTE, "noiface", NULL);
+        } else {
+            fprintf (stderr, "router: %s\n", error->message);
+            g_clear_error (&error);
+            route = apply_add (plan, FALSE, IFUP_ROUTE, "noiface", NULL);
+        }
+        for (i = 0; i < n; i++) {
+            apply_after (plan, up[i], route);
+        }
+    }
+
+    /* both addresses are up at once until the old one goes, last */
+    for (i = 0; i < n; i++) {
+        iface = lobster_snapshot_get_nth (snap, i);
+        if (hitless[i] && !plan_routes (plan->batch, snap, iface, &error)) {
+            fprintf (stderr, "%s\n", error->message);
+            g_clear_error (&error);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        iface = lobster_snapshot_get_nth (snap, i);
+        if (hitless[i] &&
+            (!lobster_address_equal (&iface->address, &iface->saved->address) ||
+             iface->address.prefix != iface->saved->address.prefix) &&
+            !lobster_netlink_delete_address (plan->batch, iface->interface, &iface->saved->address, &error)) {
+            fprintf (stderr, "%s\n", error->message);
+            g_clear_error (&error);
+        }
+    }
+
+    if ((snap->dirty & (LOBSTER_SYSTEM_DNS_SERVERS | LOBSTER_SYSTEM_DNS_SEARCH | LOBSTER_SYSTEM_DNS_OPTIONS)) &&
+        g_file_test (NSCD, G_FILE_TEST_IS_EXECUTABLE)) {
+        apply_add (plan, FALSE, NSCD, "-i", "hosts");
+    }
+
+out:
+    g_free (restart);
+    g_free (hitless);
+    g_free (down);
+    g_free (up);
+}
+
+static void
+apply_plan_clear (ApplyPlan *plan)
+{
+    guint i;
+
+    for (i = 0; i < plan->expect->len; i++) {
+        g_free (g_array_index (plan->expect, ApplyExpect, i).device);
+    }
+    for (i = 0; i < plan->tasks->len; i++) {
+        ApplyTask *task = &g_array_index (plan->tasks, ApplyTask, i);
+        g_strfreev (task->argv);
+        g_array_free (task->then, TRUE);
+    }
+    g_array_free (plan->expect, TRUE);
+    g_array_free (plan->tasks, TRUE);
+    lobster_netlink_batch_free (plan->batch);
+}
+
+/* whether some tasks wait on each other, so would never start */
+static gboolean
+apply_has_loop (ApplyPlan *plan)
+{
+    guint *waiting = g_new (guint, plan->tasks->len);
+    GArray *ready = g_array_new (FALSE, FALSE, sizeof (guint));
+    const ApplyTask *task;
+    guint i, j, then, n_started = 0;
+
+    for (i = 0; i < plan->tasks->len; i++) {
+        waiting[i] = g_array_index (plan->tasks, ApplyTask, i).waiting;
+        if (!waiting[i]) {
+            g_array_append_val (ready, i);
+        }
+    }
+    for (j = 0; j < ready->len; j++, n_started++) {
+        task = &g_array_index (plan->tasks, ApplyTask, g_array_index (ready, guint, j));
+        for (i = 0; i < task->then->len; i++) {
+            then = g_array_index (task->then, guint, i);
+            if (!--waiting[then]) {
+                g_array_append_val (ready, then);
+            }
+        }
+    }
+    g_array_free (ready, TRUE);
+    g_free (waiting);
+    return n_started < plan->tasks->len;
+}
+
+/* what was saved and applied becomes what later edits are diffed
+ * against; edits made since saved was taken stay dirty */
+static void
+snapshot_mark_saved (LobsterSnapshot *saved)
+{
+    LobsterSnapshot *draft = snapshot_draft ();
+    LobsterInterface *iface;
+    guint i;
+
+    lobster_snapshot_unref (saved_snapshot);
+    saved_snapshot = lobster_snapshot_ref (saved);
+    draft->dirty = system_diff (draft);
+
+    /* unless a reload has replaced the devices since */
+    if (draft->interfaces_by_name == saved->interfaces_by_name) {
+        for (i = 0; i < saved->n_interfaces; i++) {
+            const LobsterInterface *was = lobster_snapshot_get_nth (saved, i);
+            if (!was->dirty) {
+                continue;
+            }
+            iface = snapshot_edit_interface (draft, i);
+            iface->saved = interface_baseline (draft->arena, was);
+            iface->dirty = interface_diff (iface);
+        }
+    }
+
+    snapshot_publish (draft);
+}
+
+/* the first half of the write stage, on the main loop: plan gets
+ * what applying the edits takes, and resolver_fields what of the
+ * resolver to write; returns the snapshot to write, which only becomes
+ * the baseline once it is applied, or NULL if it can't be done */
+static LobsterSnapshot *
+save_plan (ApplyPlan *plan, guint *resolver_fields, GError **error)
+{
+    LobsterSnapshot *snap;
+
+    if (!lobster_system_ensure_loaded (error)) {
+        return NULL;
+    }
+    snap = lobster_snapshot_get ();
+
+    /* planned first, so a plan that can't run writes nothing */
+    apply_plan (snap, plan);
+    if (apply_has_loop (plan)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_LOOP,
+                     _("The interfaces are stacked on each other in a loop"));
+        lobster_snapshot_unref (snap);
+        return NULL;
+    }
+    *resolver_fields = lobster_resolver_diff (snap->resolver, saved_snapshot->resolver);
+    return snap;
+}
+
+/* the second half, on a thread of its own: the edits in snap go to
+ * the files */
+static gboolean
+save_files (LobsterSnapshot *snap, guint resolver_fields, GError **error)
+{
+    LobsterIOTransaction *tx;
+    LobsterSchemaWriter routes_writer = { &routes_schema, snap, G_MAXUINT64, 0 };
+    LobsterSchemaWriter config_writer = { &config_schema, snap, G_MAXUINT64, 0 };
+    LobsterResolverWriter resolv_writer = { snap->resolver, resolver_fields, 0 };
+    gboolean ret = FALSE;
+    guint i;
+
+    tx = lobster_io_transaction_new (NETWORK_JOURNAL);
+
+    /* snap->chunks */
+    for (i = 0; i < snap->n_interfaces; i++) {
+        if (!lobster_interface_save (lobster_snapshot_get_nth (snap, i), tx, error)) {
+            goto out;
+        }
+    }
+
+    if (!snap->dirty) {
+        fprintf (stderr, "system not dirty\n");
+    }
+
+    /* snap->resolver */
+    if (resolv_writer.fields &&
+        !lobster_io_transaction_overwrite_file (tx, RESOLV_CONF, lobster_resolver_write_func, &resolv_writer, NULL, error)) {
+        goto out;
+    }
+
+    /* snap->router */
+    if ((snap->dirty & LOBSTER_SYSTEM_ROUTER) &&
+        !lobster_io_transaction_overwrite_file (tx, NETWORK_ROUTES, lobster_schema_write_func, &routes_writer, NULL, error)) {
+        goto out;
+    }
+
+    /* snap->use_nm */
+    if ((snap->dirty & LOBSTER_SYSTEM_USE_NM) &&
+        !lobster_io_transaction_overwrite_file (tx, NETWORK_CONFIG, lobster_schema_write_func, &config_writer, NULL, error)) {
+        goto out;
+    }
+
+    ret = lobster_io_transaction_commit (tx, error);
+
+out:
+    lobster_io_transaction_free (tx);
+    return ret;
+}
+
+/*
+ * A save runs in stages from the main loop, which is never blocked
+ * while it does: the files are written and the batch is sent from a
+ * thread, then the tasks planned from them are run, up to
+ * APPLY_WORKERS at once, then the addresses the interfaces should have
+ * are checked for.  Each task and the check
+ * have a time limit, and the dialog that shows while it goes on has
+ * the tasks' output and a Cancel button.  Once a task fails or the
+ * run is cancelled no more start but the ifups of devices it already
+ * took down, so none is left down; Cancel lets those that are running
+ * finish too.  The files stay written, but the
+ * edits stay dirty until a run gets through, so applying again starts
+ * over rather than finding nothing to do.
+ */
+#define APPLY_WORKERS           8
+#define APPLY_DIALOG_DELAY      2       /* seconds before the dialog shows */
+#define APPLY_COMMAND_TIMEOUT   60
+#define APPLY_KILL_TIMEOUT      5       /* after asking a command to stop */
+#define APPLY_VERIFY_TIMEOUT    10
+#define APPLY_VERIFY_INTERVAL   250     /* milliseconds */
+
+typedef enum {
+    APPLY_WRITE,
+    APPLY_RUN,
+    APPLY_VERIFY,
+    APPLY_DONE
+} ApplyStage;
+
+struct _ApplyRun {
+    ApplyStage       stage;
+    ApplyPlan        plan;
+    LobsterSnapshot *saved;             /* what is written, the baseline once applied */
+    guint            resolver_fields;   /* of saved's resolver to write */
+    GThread         *thread;            /* doing the part of a stage that blocks */
+    gboolean         batch_failed;
+    guint            n_running;
+    guint            n_ran;
+    guint            n_to_run;          /* not counting fallbacks if the batch worked */
+    guint            verify_id;
+    gint64           verify_until;
+    GString         *log;               /* all output so far */
+    char            *doing;
+    GtkWidget       *dialog;
+    guint            dialog_id;
+    GError          *error;             /* the first; later ones are only logged */
+    GArray          *requests;          /* the SaveRequests it is for */
+};
+
+/* there is only ever one */
+static ApplyRun *applying;
+
+/*
+ * Saves asked for within lobster.save_window milliseconds of each other
+ * share one run: the edits are all in the model by then, so a single
+ * write and apply covers every one of them.  The window starts over
+ * with each save, but a steady stream of them still runs once
+ * SAVE_WINDOW_LIMIT windows have passed.  Saves asked for while a run
+ * is going on wait for the next one.
+ */
+#define SAVE_WINDOW_LIMIT       5
+
+typedef struct {
+    LobsterSaveFunc func;
+    gpointer        data;
+} SaveRequest;
+
+static GArray *save_queue;      /* NULL when empty */
+static gint64  save_queue_since;
+static guint   save_queue_id;
+
+static void     apply_stage       (ApplyRun *run, ApplyStage stage);
+static gboolean apply_thread_done (gpointer data);
+static void     save_queue_wait   (void);
+
+static void
+apply_doing (ApplyRun *run, char *doing)
+{
+    g_free (run->doing);
+    run->doing = doing;
+    if (run->dialog) {
+        gtk_label_set_text (GTK_LABEL (lookup_widget (run->dialog, "applying_label")), doing);
+    }
+}
+
+static void
+apply_log (ApplyRun *run, const char *text, gsize len)
+{
+    GtkTextView *view;
+    GtkTextBuffer *buffer;
+    GtkTextIter end;
+
+    fwrite (text, 1, len, stderr);
+    g_string_append_len (run->log, text, len);
+    if (run->dialog) {
+        view = GTK_TEXT_VIEW (lookup_widget (run->dialog, "applying_text"));
+        buffer = gtk_text_view_get_buffer (view);
+        gtk_text_buffer_get_end_iter (buffer, &end);
+        gtk_text_buffer_insert (buffer, &end, text, len);
+        gtk_text_view_scroll_mark_onscreen (view, gtk_text_buffer_get_insert (buffer));
+    }
+}
+
+/* stops a task, and then kills it if it won't */
+static gboolean
+apply_kill (gpointer data)
+{
+    ApplyTask *task = data;
+
+    fprintf (stderr, "killing %d\n", task->pid);
+    kill (-task->pid, SIGKILL);
+    task->timeout_id = 0;
+    return FALSE;
+}
+
+static void
+apply_stop (ApplyTask *task)
+{
+    if (task->timeout_id) {
+        g_source_remove (task->timeout_id);
+    }
+    fprintf (stderr, "stopping %d\n", task->pid);
+    task->stopped = TRUE;
+    kill (-task->pid, SIGTERM);
+    task->timeout_id = g_timeout_add_seconds (APPLY_KILL_TIMEOUT, apply_kill, task);
+}
+
+/* takes error; the run keeps the first, which stops it */
+static void
+apply_fail (ApplyRun *run, GError *error)
+{
+    char *text;
+
+    if (!run->error) {
+        run->error = error;
+        return;
+    }
+    text = g_strdup_printf ("%s\n", error->message);
+    apply_log (run, text, strlen (text));
+    g_free (text);
+    g_error_free (error);
+}
+
+static gboolean
+apply_timeout (gpointer data)
+{
+    ApplyTask *task = data;
+
+    apply_fail (task->run, g_error_new (G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                                        _("%s %s did not finish within %d seconds"),
+                                        task->argv[0], task->argv[1], APPLY_COMMAND_TIMEOUT));
+    task->timeout_id = 0;
+    apply_stop (task);
+    return FALSE;
+}
+
+/* output goes to the log a line at a time, so tasks running at once
+ * don't break up each other's lines */
+static void
+apply_task_log (ApplyTask *task, const char *text, gsize len)
+{
+    gsize lines;
+
+    g_string_append_len (task->partial, text, len);
+    for (lines = task->partial->len; lines && task->partial->str[lines - 1] != '\n'; lines--)
+        ;
+    if (lines) {
+        apply_log (task->run, task->partial->str, lines);
+        g_string_erase (task->partial, 0, lines);
+    }
+}
+
+/* FALSE once the pipe is done with */
+static gboolean
+apply_read (ApplyTask *task, GIOChannel *channel)
+{
+    char buf[4096];
+    gsize len;
+
+    for (;;) {
+        switch (g_io_channel_read_chars (channel, buf, sizeof (buf), &len, NULL)) {
+        case G_IO_STATUS_NORMAL:
+            apply_task_log (task, buf, len);
+            break;
+        case G_IO_STATUS_AGAIN:
+            return TRUE;
+        default:
+            return FALSE;
+        }
+    }
+}
+
+static gboolean
+apply_output (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    ApplyTask *task = data;
+    guint i = channel == task->output[1];
+
+    if (apply_read (task, channel)) {
+        return TRUE;
+    }
+    task->output_id[i] = 0;
+    return FALSE;
+}
+
+static void
+apply_close_output (ApplyTask *task)
+{
+    guint i;
+
+    for (i = 0; i < 2; i++) {
+        if (task->output_id[i]) {
+            /* what was written before the command exited */
+            apply_read (task, task->output[i]);
+            g_source_remove (task->output_id[i]);
+            task->output_id[i] = 0;
+        }
+        if (task->output[i]) {
+            g_io_channel_unref (task->output[i]);
+            task->output[i] = NULL;
+        }
+    }
+    if (task->partial->len) {
+        g_string_append_c (task->partial, '\n');
+        apply_log (task->run, task->partial->str, task->partial->len);
+    }
+    g_string_free (task->partial, TRUE);
+    task->partial = NULL;
+}
+
+static void
+apply_child_setup (gpointer data)
+{
+    /* so the scripts' own children can be stopped with them */
+    setpgid (0, 0);
 }
 
+static void apply_exited (GPid pid, gint status, gpointer data);
+
 static gboolean
-yesorno (const char *str)
+apply_start (ApplyRun *run, ApplyTask *task)
 {
-    str = strchr (str, '=');
-    if (!str) {
+    GError *error = NULL;
+    int fds[2];
+    guint i;
+
+    fprintf (stderr, "running %s %s\n", task->argv[0], task->argv[1]);
+    if (!g_spawn_async_with_pipes ("/", task->argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, apply_child_setup, NULL,
+                                   &task->pid, NULL, &fds[0], &fds[1], &error)) {
+        g_prefix_error (&error, "%s %s: ", task->argv[0], task->argv[1]);
+        apply_fail (run, error);
         return FALSE;
     }
-    ++str;
-    if (*str == '"') {
-        ++str;
+    task->state = TASK_RUNNING;
+    if (task->up != NO_TASK) {
+        g_array_index (run->plan.tasks, ApplyTask, task->up).owed = TRUE;
     }
-    return STARTSWITH (str, "yes");
+    task->run = run;
+    task->partial = g_string_new (NULL);
+    run->n_running++;
+
+    for (i = 0; i < 2; i++) {
+        task->output[i] = g_io_channel_unix_new (fds[i]);
+        g_io_channel_set_close_on_unref (task->output[i], TRUE);
+        g_io_channel_set_encoding (task->output[i], NULL, NULL);
+        g_io_channel_set_flags (task->output[i], G_IO_FLAG_NONBLOCK, NULL);
+        task->output_id[i] = g_io_add_watch (task->output[i], G_IO_IN | G_IO_HUP | G_IO_ERR, apply_output, task);
+    }
+    g_child_watch_add (task->pid, apply_exited, task);
+    task->timeout_id = g_timeout_add_seconds (APPLY_COMMAND_TIMEOUT, apply_timeout, task);
+    return TRUE;
 }
 
-static char *
-view_text (const char *name)
+/* the tasks waiting on task may start */
+static void
+apply_release (ApplyRun *run, ApplyTask *task)
 {
-    GtkTextBuffer *buf = BUFFER (name);
-    GtkTextIter start, end;
-    gtk_text_buffer_get_start_iter (buf, &start);
-    gtk_text_buffer_get_end_iter (buf, &end);
-    return gtk_text_buffer_get_text (buf, &start, &end, FALSE);
+    guint i;
+
+    task->state = TASK_DONE;
+    for (i = 0; i < task->then->len; i++) {
+        g_array_index (run->plan.tasks, ApplyTask, g_array_index (task->then, guint, i)).waiting--;
+    }
 }
 
-static gboolean
-read_net_devices (const char *file, int line_no, char *line, gpointer data, GError **error)
+/* starts what can start, and moves on once nothing runs; after an
+ * error that is only the ifups of devices already taken down, and the
+ * rest are let go in their place so those don't wait on them */
+static void
+apply_schedule (ApplyRun *run)
 {
-    char *colon;
-    while (*line && *line == ' ') {
-        ++line;
+    ApplyTask *task;
+    gboolean released = TRUE;
+    guint i;
+
+    while (released) {
+        released = FALSE;
+        for (i = 0; i < run->plan.tasks->len; i++) {
+            task = &g_array_index (run->plan.tasks, ApplyTask, i);
+            if (task->state != TASK_WAITING || task->waiting) {
+                continue;
+            }
+            /* its part of the batch went through, or it is given up */
+            if ((task->fallback && !run->batch_failed) || (run->error && !task->owed)) {
+                apply_release (run, task);
+                released = TRUE;
+            } else if (run->n_running < APPLY_WORKERS && !apply_start (run, task)) {
+                apply_release (run, task);
+                released = TRUE;
+            }
+        }
     }
-    if (!STARTSWITH (line, "eth")) {
-        return TRUE;
+
+    if (run->n_running && run->error) {
+        apply_doing (run, g_strdup (_("Bringing the interfaces that were taken down back up...")));
+        return;
     }
-    colon = strchr (line, ':');
-    if (!colon) {
-        return TRUE;
+    if (run->n_running) {
+        apply_doing (run, g_strdup_printf (_("Applying changes (%u of %u done)..."), run->n_ran, run->n_to_run));
+        return;
     }
-    *colon = '\0';
-    fprintf (stderr, "%s:%d: %s\n", file, line_no, line);
-    return lobster_interface_load (line, error);
+    apply_stage (run, run->error ? APPLY_DONE : APPLY_VERIFY);
 }
 
-static gboolean
-read_dns_servers (const char *file, int line_no, char *line, gpointer data, GError **error)
+static void
+apply_exited (GPid pid, gint status, gpointer data)
 {
-    if (!STARTSWITH (line, "nameserver ")) {
-        return TRUE;
+    ApplyTask *task = data;
+    ApplyRun *run = task->run;
+    GError *error = NULL;
+
+    g_spawn_close_pid (pid);
+    task->pid = 0;
+    if (task->timeout_id) {
+        g_source_remove (task->timeout_id);
+        task->timeout_id = 0;
     }
-    fprintf (stderr, "%s:%d: %s\n", file, line_no, line);
-    line = strchr (line, ' ');
-    if (line) {
-        g_string_append ((GString *)data, line + 1);
-        g_string_append ((GString *)data, "\n");
+    apply_close_output (task);
+    fprintf (stderr, "%s %s finished: %d\n", task->argv[0], task->argv[1], WEXITSTATUS (status));
+    run->n_running--;
+    run->n_ran++;
+
+    /* one that was stopped has set the error */
+    if (!task->stopped && !g_spawn_check_exit_status (status, &error)) {
+        g_prefix_error (&error, "%s %s: ", task->argv[0], task->argv[1]);
+        apply_fail (run, error);
     }
-    return TRUE;
+    apply_release (run, task);
+    apply_schedule (run);
 }
 
-static char *
-write_dns_servers (const char *file, int line_no, char *line, gpointer data, GError **error)
-{
-    if (line == NULL) {
-        GString *buf = g_string_new (NULL);
-        char **servers = g_strsplit_set (lobster.dns_servers, " \n\t\r,", -1);
-        int i;
-        for (i = 0; servers[i]; i++) {
-            if (*servers[i]) {
-                if (i) {
-                    g_string_append (buf, "\n");
-                }
-                g_string_append (buf, "nameserver ");
-                g_string_append (buf, servers[i]);
+/* the first expected address that isn't up yet, or NULL */
+static const ApplyExpect *
+apply_missing (ApplyRun *run)
+{
+    struct ifaddrs *addrs, *ifa;
+    LobsterAddress addr;
+    const guint8 *bytes, *mask;
+    gsize len;
+    guint i;
+
+    if (getifaddrs (&addrs) < 0) {
+        fprintf (stderr, "getifaddrs: %s\n", g_strerror (errno));
+        return NULL;
+    }
+    for (i = 0; i < run->plan.expect->len; i++) {
+        const ApplyExpect *expect = &g_array_index (run->plan.expect, ApplyExpect, i);
+
+        for (ifa = addrs; ifa; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || !ifa->ifa_netmask || ifa->ifa_addr->sa_family != expect->address.family ||
+                strcmp (ifa->ifa_name, expect->device)) {
+                continue;
+            }
+            if (ifa->ifa_addr->sa_family == AF_INET) {
+                bytes = (const guint8 *)&((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+                mask = (const guint8 *)&((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr;
+                len = 4;
+            } else {
+                bytes = (const guint8 *)&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+                mask = (const guint8 *)&((struct sockaddr_in6 *)ifa->ifa_netmask)->sin6_addr;
+                len = 16;
+            }
+            lobster_address_clear (&addr);
+            addr.family = ifa->ifa_addr->sa_family;
+            addr.prefix = lobster_address_mask_to_prefix (mask, len);
+            memcpy (addr.bytes, bytes, len);
+            if (lobster_address_equal (&addr, &expect->address) && addr.prefix == expect->address.prefix) {
+                break;
             }
         }
-        fprintf (stderr, "%s: appending %s\n", file, buf->str);
-        g_strfreev (servers);
-        return g_string_free (buf, FALSE);
-    } else if (STARTSWITH (line, "nameserver ")) {
-        fprintf (stderr, "%s:%d: skipping %s\n", file, line_no, line);
-        return g_strdup ("");
+        if (!ifa) {
+            freeifaddrs (addrs);
+            return expect;
+        }
     }
-    fprintf (stderr, "%s:%d: keeping %s\n", file, line_no, line);
-    return line;
+    freeifaddrs (addrs);
+    return NULL;
 }
 
 static gboolean
-check_for_nm (const char *file, int line_no, char *line, gpointer data, GError **error)
+apply_verify (gpointer data)
 {
-    if (!STARTSWITH (line, "NETWORKMANAGER=")) {
+    ApplyRun *run = data;
+    const ApplyExpect *missing = apply_missing (run);
+    char *address;
+
+    if (missing && g_get_monotonic_time () < run->verify_until) {
         return TRUE;
     }
-    lobster.use_nm = yesorno (line);
-    fprintf (stderr, "%s:%d: %s -> %d\n", file, line_no, line, lobster.use_nm);
-    return TRUE;
-}
-
-static char *
-write_nm (const char *file, int line_no, char *line, gpointer data, GError **error)
-{
-    gboolean *written = data;
-    if (!line) {
-        if (*written) {
-            return g_strdup ("");
-        }
-    } else if (!STARTSWITH (line, "NETWORKMANAGER=")) {
-        return line;
+    if (missing) {
+        address = lobster_address_to_string (&missing->address, TRUE);
+        g_set_error (&run->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     _("%s does not have the address %s after %d seconds"),
+                     missing->device, address, APPLY_VERIFY_TIMEOUT);
+        g_free (address);
     }
-    *written = TRUE;
-    return g_strdup_printf ("NETWORKMANAGER=\"%s\"", lobster.use_nm ? "yes" : "no");
+    run->verify_id = 0;
+    apply_stage (run, APPLY_DONE);
+    return FALSE;
 }
 
-static gboolean
-read_routes (const char *file, int line_no, char *line, gpointer data, GError **error)
+/* the rest of the run is given up, but a device that has been taken
+ * down is still brought back up; a stage on a thread stops once the
+ * thread is done */
+static void
+apply_response (GtkDialog *dialog, gint response, gpointer data)
 {
-    char *eol;
-    if (STARTSWITH (line, "default ")) {
-        line = strchr (line, ' ') + 1;
-        eol = strchr (line, ' ');
-        if (eol) {
-            *eol = '\0';
+    ApplyRun *run = data;
+    gboolean restarted = FALSE;
+    guint i;
+
+    if (run->error) {
+        return;
+    }
+    fprintf (stderr, "cancelling\n");
+    for (i = 0; run->plan.tasks && i < run->plan.tasks->len; i++) {
+        restarted |= g_array_index (run->plan.tasks, ApplyTask, i).owed;
+    }
+    g_set_error_literal (&run->error, G_FILE_ERROR, G_FILE_ERROR_INTR, restarted ?
+                         _("Applying the settings was cancelled.  They are saved, and the interfaces that were "
+                           "restarted are back up with them; the rest take effect once they are applied again "
+                           "or the network next starts.") :
+                         _("Applying the settings was cancelled.  They are saved, and take effect once they are "
+                           "applied again or the network next starts."));
+    gtk_widget_set_sensitive (lookup_widget (run->dialog, "applying_cancel_button"), FALSE);
+    if (run->stage == APPLY_VERIFY) {
+        g_source_remove (run->verify_id);
+        run->verify_id = 0;
+        apply_stage (run, APPLY_DONE);
+        return;
+    }
+    for (i = 0; run->plan.tasks && i < run->plan.tasks->len; i++) {
+        ApplyTask *task = &g_array_index (run->plan.tasks, ApplyTask, i);
+        if (task->state == TASK_RUNNING && !task->owed) {
+            apply_stop (task);
         }
-    } else if (strchr (line, ' ')) {
-        return TRUE;
     }
-    if (*line) {
-        g_free (lobster.router);
-        lobster.router = g_strdup (line);
+    if (!run->thread) {
+        apply_schedule (run);
     }
-    return TRUE;
 }
 
-static char *
-write_routes (const char *file, int line_no, char *line, gpointer data, GError **error)
+static gboolean
+show_dialog (gpointer data)
 {
-    gboolean *written = data;
-    if (!line) {
-        if (*written) {
-            return g_strdup ("");
-        }
-    } else if (!STARTSWITH (line, "default ") || strchr (line, ' ')) {
-        return line;
-    }
-    *written = TRUE;
-    return g_strdup_printf ("default %s", lobster.router);
+    ApplyRun *run = data;
+    GtkWidget *dialog = create_applying_dialog ();
+
+    gtk_window_set_transient_for (GTK_WINDOW (dialog), GTK_WINDOW (lobster.dialog));
+    g_signal_connect (dialog, "response", G_CALLBACK (apply_response), run);
+    run->dialog = dialog;
+    run->dialog_id = 0;
+    gtk_label_set_text (GTK_LABEL (lookup_widget (dialog, "applying_label")), run->doing);
+    gtk_text_buffer_set_text (gtk_text_view_get_buffer (GTK_TEXT_VIEW (lookup_widget (dialog, "applying_text"))),
+                              run->log->str, run->log->len);
+    gtk_widget_show_all (dialog);
+    fprintf (stderr, "creating dialog...\n");
+    return FALSE;
 }
 
-gboolean
-lobster_system_load (GError **error)
+static void
+apply_done (ApplyRun *run)
 {
-    GString *servers;
-    GList *li;
+    guint i;
 
-    /* lobster.interfaces */
-    g_list_foreach (lobster.interfaces, (GFunc)lobster_interface_free, NULL);
-    g_list_free (lobster.interfaces);
-    lobster.interfaces = NULL;
-    if (!lobster_io_read_file (NET_DEVICES, read_net_devices, NULL, error)) {
-        return FALSE;
+    if (run->dialog_id) {
+        g_source_remove (run->dialog_id);
     }
-
-    /* lobster.dns_servers */
-    servers = g_string_new (NULL);
-    if (!lobster_io_read_file (RESOLV_CONF, read_dns_servers, servers, error)) {
-        return FALSE;
+    if (run->dialog) {
+        gtk_widget_destroy (run->dialog);
+    }
+    if (run->saved && !run->error) {
+        snapshot_mark_saved (run->saved);
+    }
+    if (run->saved) {
+        lobster_snapshot_unref (run->saved);
+    }
+    ENABLED ("network_dialog", TRUE);
+    applying = NULL;
+    if (save_queue) {
+        save_queue_since = g_get_monotonic_time ();
+        save_queue_wait ();
     }
-    g_free (lobster.dns_servers);
-    lobster.dns_servers = g_string_free (servers, FALSE);
-
-    fprintf (stderr, "have nameservers: %s\n", lobster.dns_servers);
 
-    /* lobster.router */
-    if (!lobster_io_read_file (NETWORK_ROUTES, read_routes, NULL, error)) {
-        return FALSE;
+    for (i = 0; i < run->requests->len; i++) {
+        SaveRequest *request = &g_array_index (run->requests, SaveRequest, i);
+        if (request->func) {
+            request->func (run->error, run->requests->len, request->data);
+        }
+    }
+    g_array_free (run->requests, TRUE);
+    g_clear_error (&run->error);
+    if (run->plan.tasks) {
+        apply_plan_clear (&run->plan);
     }
+    g_string_free (run->log, TRUE);
+    g_free (run->doing);
+    g_free (run);
+}
 
-    fprintf (stderr, "router: %s\n", lobster.router);
+/* the tasks start once the batch is sent */
+static void
+apply_tasks (ApplyRun *run)
+{
+    guint i;
 
-    /* lobster.use_nm */
-    if (!lobster_io_read_file (NETWORK_CONFIG, check_for_nm, NULL, error)) {
-        return FALSE;
+    for (i = 0; i < run->plan.tasks->len; i++) {
+        run->n_to_run += run->batch_failed || !g_array_index (run->plan.tasks, ApplyTask, i).fallback;
     }
+    apply_schedule (run);
+}
 
-    lobster.dirty = FALSE;
+/* the threads return the error they hit, or NULL */
+static gpointer
+write_thread (gpointer data)
+{
+    ApplyRun *run = data;
+    GError *error = NULL;
 
-    return TRUE;
+    save_files (run->saved, run->resolver_fields, &error);
+    g_idle_add (apply_thread_done, run);
+    return error;
 }
 
-static void
-apply_finished (GPid pid, gint status, gpointer data)
+static gpointer
+batch_thread (gpointer data)
 {
-    *(int *)data = status;
-    gtk_main_quit ();
-    fprintf (stderr, "child finished: %d\n", WEXITSTATUS (status));
+    ApplyRun *run = data;
+    GError *error = NULL;
+
+    lobster_netlink_batch_send (run->plan.batch, &error);
+    g_idle_add (apply_thread_done, run);
+    return error;
 }
 
+/* back on the main loop once a stage's thread is done */
 static gboolean
-show_dialog (gpointer data)
+apply_thread_done (gpointer data)
 {
-    GtkWidget *dialog = create_applying_dialog ();
-    gtk_window_set_transient_for (GTK_WINDOW (dialog), GTK_WINDOW (lobster.dialog));
-    gtk_widget_show_all (dialog);
-    *(GtkWidget **)data = dialog;
-    fprintf (stderr, "creating dialog...\n");
+    ApplyRun *run = data;
+    GError *error = g_thread_join (run->thread);
+
+    run->thread = NULL;
+    if (run->stage == APPLY_WRITE) {
+        /* over a Cancel, which says the settings are saved */
+        if (error) {
+            g_clear_error (&run->error);
+            run->error = error;
+        }
+        apply_stage (run, run->error ? APPLY_DONE : APPLY_RUN);
+    } else {
+        if (error) {
+            fprintf (stderr, "%s; falling back to scripts\n", error->message);
+            g_error_free (error);
+            run->batch_failed = TRUE;
+        }
+        apply_tasks (run);
+    }
     return FALSE;
 }
 
-static gboolean
-lobster_system_apply (GError **error)
+static void
+apply_stage (ApplyRun *run, ApplyStage stage)
 {
-    GtkWidget *dialog = NULL;
-    guint dialog_id;
-    GPid pid;
-    int status = -1;
+    run->stage = stage;
+    switch (stage) {
+    case APPLY_WRITE:
+        apply_doing (run, g_strdup (_("Saving changes...")));
+        run->saved = save_plan (&run->plan, &run->resolver_fields, &run->error);
+        if (!run->saved) {
+            apply_stage (run, APPLY_DONE);
+            break;
+        }
+        run->thread = g_thread_new ("write", write_thread, run);
+        break;
 
-    char *argv[4] = { "/sbin/service", "network", "restart", NULL };
+    case APPLY_RUN:
+        apply_doing (run, g_strdup (_("Applying changes...")));
+        if (lobster_netlink_batch_size (run->plan.batch)) {
+            run->thread = g_thread_new ("batch", batch_thread, run);
+        } else {
+            apply_tasks (run);
+        }
+        break;
 
-    ENABLED ("network_dialog", FALSE);
+    case APPLY_VERIFY:
+        if (!run->plan.expect->len) {
+            apply_stage (run, APPLY_DONE);
+            break;
+        }
+        apply_doing (run, g_strdup (_("Checking the interfaces...")));
+        run->verify_until = g_get_monotonic_time () + APPLY_VERIFY_TIMEOUT * G_USEC_PER_SEC;
+        if (apply_verify (run)) {
+            run->verify_id = g_timeout_add (APPLY_VERIFY_INTERVAL, apply_verify, run);
+        }
+        break;
 
-    if (!g_spawn_async ("/", argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, error)) {
-        fprintf (stderr, "could not spawn network\n");
-        ENABLED ("network_dialog", TRUE);
-        return FALSE;
+    case APPLY_DONE:
+        fprintf (stderr, "apply done for %u saves%s%s\n", run->requests->len,
+                 run->error ? ": " : "", run->error ? run->error->message : "");
+        apply_done (run);
+        break;
     }
+}
 
-    dialog_id = g_timeout_add_seconds (2, show_dialog, &dialog);
-    g_child_watch_add (pid, apply_finished, &status);
-
-    gtk_main ();
-
-    if (dialog) {
-        gtk_widget_destroy (dialog);
-    } else {
-        g_source_remove (dialog_id);
-    }
+static gboolean
+save_queue_run (gpointer data)
+{
+    ApplyRun *run = applying = g_new0 (ApplyRun, 1);
 
-    ENABLED ("network_dialog", TRUE);
+    save_queue_id = 0;
+    run->requests = save_queue;
+    save_queue = NULL;
+    run->log = g_string_new (NULL);
+    fprintf (stderr, "saving for %u saves\n", run->requests->len);
 
-    return WEXITSTATUS (status) == 0;
+    /* editing goes on while saves wait, so more can join them */
+    ENABLED ("network_dialog", FALSE);
+    run->dialog_id = g_timeout_add_seconds (APPLY_DIALOG_DELAY, show_dialog, run);
+    apply_stage (run, APPLY_WRITE);
+    return FALSE;
 }
 
-gboolean
-lobster_system_save (GError **error)
+static void
+save_queue_wait (void)
 {
-    GList *li;
-    gboolean written_nm = FALSE;
-    gboolean written_routes = FALSE;
-
-    /* lobster.interfaces */
-    for (li = lobster.interfaces; li; li = li->next) {
-        if (!lobster_interface_save (li->data, error)) {
-            return FALSE;
-        }
-    }
+    gint64 left = save_queue_since - g_get_monotonic_time () +
+        (gint64)SAVE_WINDOW_LIMIT * lobster.save_window * 1000;
 
-    if (!lobster.dirty) {
-        fprintf (stderr, "system not dirty\n");
-        goto apply_settings;
+    if (save_queue_id) {
+        g_source_remove (save_queue_id);
     }
+    save_queue_id = g_timeout_add (CLAMP (left / 1000, 0, lobster.save_window), save_queue_run, NULL);
+}
 
-    /* lobster.dns_servers */
-    g_free (lobster.dns_servers);
-    lobster.dns_servers = view_text ("dns_text");
-    if (!lobster_io_overwrite_file (RESOLV_CONF, write_dns_servers, NULL, error)) {
-        return FALSE;
-    }
+void
+lobster_system_save (LobsterSaveFunc func, gpointer data)
+{
+    SaveRequest request = { func, data };
 
-    /* lobster.router */
-    g_free (lobster.router);
-    lobster.router = g_strdup (gtk_entry_get_text (GTK_ENTRY (WIDGET ("router_entry"))));
-    if (!lobster_io_overwrite_file (NETWORK_ROUTES, write_routes, &written_routes, error)) {
-        return FALSE;
+    if (!save_queue) {
+        save_queue = g_array_new (FALSE, FALSE, sizeof (SaveRequest));
+        save_queue_since = g_get_monotonic_time ();
     }
-
-    /* lobster.use_nm */
-    lobster.use_nm = ISTOGGLED ("nm_toggle");
-    if (!lobster_io_overwrite_file (NETWORK_CONFIG, write_nm, &written_nm, error)) {
-        return FALSE;
+    g_array_append_val (save_queue, request);
+    /* else apply_done() starts the wait */
+    if (!applying) {
+        save_queue_wait ();
     }
-
-    lobster.dirty = FALSE;
-
-apply_settings:
-    return lobster_system_apply (error);
 }
 
 static char *
@@ -344,23 +2958,27 @@ device_text (LobsterInterface *iface)
 void
 lobster_system_display (void)
 {
-    GList *li;
     GtkComboBox *combo;
+    GtkListStore *store;
     char *iface;
+    guint i;
 
     lobster_ignore_edits ();
 
-    TOGGLED ("nm_toggle", lobster.use_nm);
+    TOGGLED ("nm_toggle", published->use_nm);
 
     combo = GTK_COMBO_BOX (WIDGET ("connection_list"));
     /* there doesn't seem to be a "clear" method, so poach the store
-     * creation from _new_text() */
-    gtk_combo_box_set_model (combo, GTK_TREE_MODEL (gtk_list_store_new (1, G_TYPE_STRING)));
-    for (li = lobster.interfaces; li; li = li->next) {
-        iface = device_text ((LobsterInterface *)li->data);
-        gtk_combo_box_append_text (combo, iface);
+     * creation from _new_text(); it is filled before the combo sees it
+     * so rows don't each cost a round of signals */
+    store = gtk_list_store_new (1, G_TYPE_STRING);
+    for (i = 0; i < lobster_interface_count (); i++) {
+        iface = device_text (lobster_interface_get_nth (i));
+        gtk_list_store_insert_with_values (store, NULL, -1, 0, iface, -1);
         g_free (iface);
     }
+    gtk_combo_box_set_model (combo, GTK_TREE_MODEL (store));
+    g_object_unref (store);
     gtk_combo_box_set_active (combo, 0);
 
     ENABLED ("network_revert_button", FALSE);
@@ -369,37 +2987,13 @@ lobster_system_display (void)
     lobster_accept_edits ();
 }
 
-static const char *
-valid_octet (const char *s)
-{
-    const char *e;
-    int val = 0;
-    for (e = s; *e && g_ascii_isdigit (*e); e++)
-        if (256 <= (val = val * 10 + (*e - '0')))
-            return NULL;
-    return e == s ? NULL : e;
-}
-
+/* a whole address, without a prefix */
 static gboolean
 valid_ip_string (const char *s)
 {
-    s = valid_octet (s);
-    if (!s || *s != '.') {
-        return FALSE;
-    }
-    s = valid_octet (s+1);
-    if (!s || *s != '.') {
-        return FALSE;
-    }
-    s = valid_octet (s+1);
-    if (!s || *s != '.') {
-        return FALSE;
-    }
-    s = valid_octet (s+1);
-    if (!s || *s != '\0') {
-        return FALSE;
-    }
-    return TRUE;
+    LobsterAddress addr;
+    gboolean had_prefix;
+    return lobster_address_parse (&addr, s, strlen (s), &had_prefix) && !had_prefix;
 }
 
 static void
@@ -415,7 +3009,12 @@ set_warning_label (const char *s)
 gboolean
 lobster_is_valid (void)
 {
+    GError *error = NULL;
+    LobsterAddress router;
+    gboolean dhcp = FALSE;
     char *s;
+    char *message = NULL;
+    guint i;
 
     gboolean enabled = FALSE;
     const char *warning = NULL;
@@ -430,26 +3029,62 @@ lobster_is_valid (void)
         }                                                               \
     } G_STMT_END;
 
-    CHECK_ENTRY ("address_entry", _("The address must be a valid IP address"));
-    CHECK_ENTRY ("subnet_entry",  _("The subnet mask must be a valid ip mask"));
     CHECK_ENTRY ("router_entry",  _("The router must be a valid IP address"));
 
 #undef CHECK_ENTRY
 
-    if (ISENABLED ("dns_text")) {
-        char **servers;
-        int i;
-
-        s = view_text ("dns_text");
-        servers = g_strsplit_set (s, " \n\t\r,", -1);
-        for (i = 0; servers[i]; i++) {
-            if (servers[i][0] && !valid_ip_string (servers[i])) {
-                warning = _("DNS servers must be valid IP addresses");
-                break;
-            }
+    /* every interface, not just the one on show */
+    if (!lobster_system_ensure_loaded (&error)) {
+        fprintf (stderr, "could not load interfaces: %s\n", error->message);
+        g_error_free (error);
+        warning = _("Not every interface could be loaded");
+        goto set_enabled;
+    }
+    for (i = 0; column_flags && i < column_flags->len; i++) {
+        if (!(column_flags->data[i] & COLUMN_STATIC)) {
+            continue;
+        }
+        if (column_flags->data[i] & COLUMN_BAD_ADDRESS) {
+            message = g_strdup_printf (_("The address of %s must be a valid IP address"),
+                                       lobster_interface_get_nth (i)->interface);
+            warning = message;
+            goto set_enabled;
         }
-        g_strfreev (servers);
-        g_free (s);
+        if (column_flags->data[i] & COLUMN_BAD_SUBNET) {
+            message = g_strdup_printf (_("The subnet mask of %s must be a valid ip mask"),
+                                       lobster_interface_get_nth (i)->interface);
+            warning = message;
+            goto set_enabled;
+        }
+    }
+
+    columns_trie ();
+    if (column_has_conflict) {
+        const LobsterAddress *a = &g_array_index (column_addresses, LobsterAddress, column_conflict[0]);
+        const LobsterAddress *b = &g_array_index (column_addresses, LobsterAddress, column_conflict[1]);
+        message = g_strdup_printf (lobster_address_equal (a, b) ?
+                                   _("%s and %s have the same address") : _("The subnets of %s and %s overlap"),
+                                   lobster_interface_get_nth (column_conflict[0])->interface,
+                                   lobster_interface_get_nth (column_conflict[1])->interface);
+        warning = message;
+        goto set_enabled;
+    }
+
+    /* a router has to be on a subnet, unless DHCP may bring one */
+    for (i = 0; column_flags && i < column_flags->len && !dhcp; i++) {
+        dhcp = (column_flags->data[i] & COLUMN_DHCP) != 0;
+    }
+    s = (char *)gtk_entry_get_text (GTK_ENTRY (WIDGET ("router_entry")));
+    lobster_address_clear (&router);
+    if (ISENABLED ("router_entry") && *s && !dhcp &&
+        lobster_address_parse (&router, s, strlen (s), NULL) &&
+        !lobster_trie_lookup (columns_trie (), &router, NULL)) {
+        warning = _("The router must be on the subnet of an interface");
+        goto set_enabled;
+    }
+
+    if (ISENABLED ("dns_text") && published->resolver->invalid) {
+        warning = _("DNS servers must be valid IP addresses");
     }
 
     enabled = !warning;
@@ -458,15 +3093,35 @@ set_enabled:
     ENABLED ("network_revert_button", enabled);
     ENABLED ("network_apply_button", enabled);
     set_warning_label (warning);
+    g_free (message);
 
     return enabled;
 }
 
+/* edits are copied into a new generation as they are made, and diffed
+ * against what was loaded so that undoing an edit by hand cleans it
+ * again */
 void
 lobster_system_dirty (void)
 {
     if (!lobster.ignore_edits) {
-        lobster.dirty = TRUE;
+        LobsterSnapshot *draft = snapshot_draft ();
+        LobsterArena *edits = snapshot_edits (draft);
+        const char *router = gtk_entry_get_text (GTK_ENTRY (WIDGET ("router_entry")));
+        char *servers = view_text ("dns_text");
+
+        /* servers the file had that we can't read stay as they were */
+        draft->resolver = lobster_resolver_parse (servers, strlen (servers), TRUE, draft->resolver, edits);
+        draft->router = lobster_arena_intern (edits, router, strlen (router));
+        lobster_arena_unref (draft->system_arena);
+        draft->system_arena = lobster_arena_ref (edits);
+        g_free (servers);
+
+        draft->use_nm = ISTOGGLED ("nm_toggle");
+
+        draft->dirty = system_diff (draft);
+        history_record (HISTORY_SYSTEM, published, draft);
+        snapshot_publish (draft);
         lobster_is_valid ();
     } else {
         fprintf (stderr, "ignoring system edit\n");
@@ -477,9 +3132,30 @@ void
 lobster_interface_dirty (void)
 {
     if (!lobster.ignore_edits) {
-        LobsterInterface *iface = lobster_interface_get_selected ();
-        if (iface) {
-            iface->dirty = TRUE;
+        LobsterInterface *selected = lobster_interface_get_selected ();
+        /* a stand-in that couldn't be loaded has nothing to diff against */
+        if (selected && selected->loaded) {
+            LobsterSnapshot *draft = snapshot_draft ();
+            LobsterInterface *iface = snapshot_edit_interface (draft, selected->index);
+            gboolean cidr = iface->cidr;
+            const char *text;
+
+            /* the same rules as reading the file, so an empty entry
+             * is no address rather than a bad one; the subnet entry
+             * always sets the prefix, and how the file spells it is
+             * kept */
+            text = gtk_entry_get_text (GTK_ENTRY (WIDGET ("address_entry")));
+            parse_ipaddr (iface, text, strlen (text), NULL);
+            iface->cidr = cidr;
+            text = gtk_entry_get_text (GTK_ENTRY (WIDGET ("subnet_entry")));
+            set_prefix (iface, text, strlen (text));
+            iface->enabled = ISTOGGLED ("nm_toggle") || ISTOGGLED ("enable_toggle");
+            iface->dhcp = ISTOGGLED ("dhcp_toggle");
+
+            iface->dirty = interface_diff (iface);
+            history_record (iface->index, published, draft);
+            snapshot_publish (draft);
+            columns_update (iface);
             lobster_is_valid ();
         }
     } else {
@@ -490,88 +3166,26 @@ lobster_interface_dirty (void)
 gboolean
 lobster_is_dirty (void)
 {
-    GList *li;
-    if (lobster.dirty) {
+    guint i;
+    if (!published) {
+        return FALSE;
+    }
+    if (published->dirty) {
         return TRUE;
     }
-    for (li = lobster.interfaces; li; li = li->next) {
-        if (((LobsterInterface *)li->data)->dirty) {
+    for (i = 0; i < published->n_interfaces; i++) {
+        if (lobster_snapshot_get_nth (published, i)->dirty) {
             return TRUE;
         }
     }
     return FALSE;
 }
 
-typedef enum {
-    LINE_UNKNOWN,
-    LINE_STARTMODE,
-    LINE_BOOTPROTO,
-    LINE_IPADDR,
-    LINE_NETMASK
-} LineType;
-
-static char *
-trim_quotes (char *line)
-{
-    char *ret = line;
-    line = strchr (ret, '\'');
-    if (line) {
-        *line = '\0';
-    }
-    line = strchr (ret, '"');
-    if (line) {
-        *line = '\0';
-    }
-    return ret;
-}
-
 static gboolean
-interface_read_func (const char *file, int line_no, char *line, gpointer data, GError **error)
+interface_read_func (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
 {
-    LobsterInterface *iface = (LobsterInterface *)data;
-    LineType type = LINE_UNKNOWN;
-
-    if (STARTSWITH (line, "STARTMODE=")) {
-        type = LINE_STARTMODE;
-    } else if (STARTSWITH (line, "BOOTPROTO=")) {
-        type = LINE_BOOTPROTO;
-    } else if (STARTSWITH (line, "IPADDR=")) {
-        type = LINE_IPADDR;
-    } else if (STARTSWITH (line, "NETMASK=")) {
-        type = LINE_NETMASK;
-    } else {
-        return TRUE;
-    }
-
-    fprintf (stderr, "%s:%d: %s => %d\n", file, line_no, line, type);
-    line = strchr (line, '=');
-    if (!line) {
-        return TRUE;
-    }
-
-    line++;
-    if (*line == '\'' || *line == '"') {
-        line++;
-    }
-
-    switch (type) {
-    case LINE_STARTMODE:
-        iface->enabled = !STARTSWITH (line, "off");
-        break;
-    case LINE_BOOTPROTO:
-        iface->dhcp = !STARTSWITH (line, "static");
-        break;
-    case LINE_IPADDR:
-        g_free (iface->address);
-        iface->address = g_strdup (trim_quotes (line));
-        break;
-    case LINE_NETMASK:
-        g_free (iface->subnet);
-        iface->subnet = g_strdup (trim_quotes (line));
-        break;
-    default:
-        g_assert_not_reached ();
-        break;
+    if (lobster_schema_read_line (&ifcfg_schema, line, len, data, load_arena)) {
+        fprintf (stderr, "%s:%d: %.*s\n", file, line_no, (int)len, line);
     }
     return TRUE;
 }
@@ -579,142 +3193,157 @@ interface_read_func (const char *file, int line_no, char *line, gpointer data, G
 gboolean
 lobster_interface_load (const char *interface, GError **error)
 {
-    LobsterInterface *iface = g_new0 (LobsterInterface, 1);
+    LobsterSnapshot *draft = snapshot_draft ();
+    LobsterArena *arena = draft->arena;
+    LobsterInterface *iface = interface_new (arena, lobster_arena_strndup (arena, interface, strlen (interface)));
+    LobsterInterface *old;
     char *file = g_strdup_printf ("%s-%s", NETWORK_IFCFG, interface);
-    
-    iface->interface = g_strdup (interface);
-    if (!lobster_io_read_file (file, interface_read_func, iface, error)) {
-        g_free (file);
-        lobster_interface_free (iface);
+    gboolean ret;
+
+    load_arena = arena;
+    ret = lobster_io_map_file (file, interface_read_func, iface, error);
+    load_arena = NULL;
+    g_free (file);
+    if (!ret) {
+        lobster_interface_unref (iface);
+        lobster_snapshot_unref (draft);
         return FALSE;
     }
-    g_free (file);
-
-    fprintf (stderr, "got interface: %s %d %d %s %s\n", 
-             iface->interface,
-             iface->enabled,
-             iface->dhcp,
-             iface->address,
-             iface->subnet);
 
-    lobster.interfaces = g_list_append (lobster.interfaces, iface);
+    history_truncate (0);
+    iface->loaded = TRUE;
+    old = lobster_snapshot_get_from_device (draft, interface);
+    if (old && !old->loaded && !--lazy_remaining) {
+        lazy_finish ();
+    }
+    snapshot_add_interface (draft, iface);
+    interface_loaded (draft, iface);
+    snapshot_publish (draft);
 
     return TRUE;
 }
 
-typedef struct {
-    LobsterInterface *iface;
-    gboolean wrote_address;
-    gboolean wrote_subnet;
-    gboolean wrote_enabled;
-    gboolean wrote_dhcp;
-} InterfaceWriteData;
-
-static char *
-interface_write_func (const char *file, int line_no, char *line, gpointer data, GError **error)
+/* iface has just been added to snap, which is about to be published */
+static void
+interface_loaded (LobsterSnapshot *snap, LobsterInterface *iface)
 {
-    InterfaceWriteData *iwd = data;
-    LobsterInterface *iface = iwd->iface;
+    char *address = lobster_address_to_string (&iface->address, TRUE);
 
-    if (!line) {
-        GString *buf = g_string_new (NULL);
+    fprintf (stderr, "got interface: %s %d %d %s\n",
+             iface->interface,
+             iface->enabled,
+             iface->dhcp,
+             address);
+    g_free (address);
 
-        if (!iwd->wrote_address) {
-            g_string_append_printf (buf, "IPADDR='%s'\n", (!iface->enabled || iface->dhcp) ? "" : iface->address);
-        }
-        if (!iwd->wrote_subnet) {
-            g_string_append_printf (buf, "NETMASK='%s'\n", (!iface->enabled || iface->dhcp) ? "" : iface->subnet);
-        }
-        if (!iwd->wrote_enabled) {
-            g_string_append_printf (buf, "STARTMODE='%s'\n", iface->enabled ? "auto" : "off");
-        }
-        if (!iwd->wrote_dhcp) {
-            g_string_append_printf (buf, "BOOTPROTO='%s'\n", (!iface->enabled || iface->dhcp) ? "dhcp+autoip" : "static");
-        }
-        return g_string_free (buf, FALSE);
-    } else if (STARTSWITH (line, "IPADDR=")) {
-        iwd->wrote_address = TRUE;
-        return g_strdup_printf ("IPADDR='%s'", (!iface->enabled || iface->dhcp) ? "" : iface->address);
-    } else if (STARTSWITH (line, "NETMASK=")) {
-        iwd->wrote_subnet = TRUE;
-        return g_strdup_printf ("NETMASK='%s'", (!iface->enabled || iface->dhcp) ? "" : iface->subnet);
-    } else if (STARTSWITH (line, "STARTMODE=")) {
-        iwd->wrote_enabled = TRUE;
-        return g_strdup_printf ("STARTMODE='%s'", iface->enabled ? "auto" : "off");
-    } else if (STARTSWITH (line, "BOOTPROTO=")) {
-        iwd->wrote_dhcp = TRUE;
-        return g_strdup_printf ("BOOTPROTO='%s'", (!iface->enabled || iface->dhcp) ? "dhcp+autoip" : "static");
-    }
-    return line;
+    iface->saved = interface_baseline (snap->arena, iface);
+    iface->dirty = 0;
+    interface_assign_id (iface);
+    columns_update (iface);
 }
 
 gboolean
-lobster_interface_save (LobsterInterface *iface, GError **error)
+lobster_interface_save (LobsterInterface *iface, LobsterIOTransaction *tx, GError **error)
 {
-    InterfaceWriteData iwd = { iface, FALSE, FALSE, FALSE, FALSE };
+    LobsterSchemaWriter writer = { &ifcfg_schema, iface, ifcfg_dirty_keys (iface), 0 };
+    char *file;
+    gboolean ret;
 
     if (!iface->dirty) {
         fprintf (stderr, "%s: not dirty\n", iface->interface);
         return TRUE;
     }
 
-    char *file = g_strdup_printf ("%s-%s", NETWORK_IFCFG, iface->interface);
-
-    g_free (iface->address);
-    iface->address = g_strdup (gtk_entry_get_text (GTK_ENTRY (WIDGET ("address_entry"))));
-
-    g_free (iface->subnet);
-    iface->subnet = g_strdup (gtk_entry_get_text (GTK_ENTRY (WIDGET ("subnet_entry"))));
-
-    iface->enabled = ISTOGGLED ("nm_toggle") || ISTOGGLED ("enable_toggle");
-    iface->dhcp = ISTOGGLED ("dhcp_toggle");
-
-    iface->dirty = FALSE;
-
-    if (!lobster_io_overwrite_file (file, interface_write_func, &iwd, error)) {
-        g_free (file);
-        return FALSE;
-    }
-
+    file = g_strdup_printf ("%s-%s", NETWORK_IFCFG, iface->interface);
+    ret = lobster_io_transaction_overwrite_file (tx, file, lobster_schema_write_func, &writer, NULL, error);
     g_free (file);
 
-    return TRUE;
+    return ret;
 }
 
-void
-lobster_interface_free (LobsterInterface *iface)
+guint
+lobster_interface_count (void)
 {
-    g_free (iface->interface);
-    iface->interface = NULL;
-    
-    g_free (iface->address);
-    iface->address = NULL;
+    return published ? published->n_interfaces : 0;
+}
 
-    g_free (iface->subnet);
-    iface->subnet = NULL;
+LobsterInterface *
+lobster_interface_get_nth (guint index)
+{
+    return published ? lobster_snapshot_get_nth (published, index) : NULL;
+}
 
-    g_free (iface);
+LobsterInterface *
+lobster_interface_get_from_id (guint id)
+{
+    guint index = interfaces_by_id && id && id <= interfaces_by_id->len ?
+        g_array_index (interfaces_by_id, guint, id - 1) : 0;
+    return index ? lobster_interface_get_nth (index - 1) : NULL;
 }
 
 LobsterInterface *
 lobster_interface_get_from_device (const char *interface)
 {
+    return lobster_snapshot_get_from_device (published, interface);
+}
+
+/* an interface's own subnet beats a route as long, and the router
+ * stands in for the gateway of the default route */
+gboolean
+lobster_system_route (const LobsterAddress *addr, LobsterAddress *gateway, const char **device)
+{
+    LobsterAddress host = *addr, router;
+    const LobsterRoute *route;
     LobsterInterface *iface;
-    GList *li;
-    for (li = lobster.interfaces; li; li = li->next) {
-        iface = li->data;
-        if (!strcmp (iface->interface, interface)) {
-            return iface;
-        }
+
+    host.prefix = LOBSTER_ADDRESS_NO_PREFIX;
+    lobster_address_clear (gateway);
+    *device = NULL;
+    if (!published) {
+        return FALSE;
     }
-    return NULL;
+
+    route = published->routes ? lobster_route_table_lookup (published->routes, &host) : NULL;
+    iface = lobster_interface_get_from_address (&host);
+    if (iface && (!route || iface->address.prefix >= route->destination.prefix)) {
+        *device = iface->interface;
+        return TRUE;
+    }
+
+    lobster_address_clear (&router);
+    if ((!route || !route->destination.prefix) && published->router &&
+        lobster_address_parse (&router, published->router, strlen (published->router), NULL) &&
+        router.family == host.family) {
+        *gateway = router;
+        *device = route ? route->device : NULL;
+    } else if (route) {
+        *gateway = route->gateway;
+        *device = route->device;
+    } else {
+        return FALSE;
+    }
+
+    /* the gateway is reached through the subnet that holds it */
+    if (!*device && gateway->family != AF_UNSPEC && (iface = lobster_interface_get_from_address (gateway))) {
+        *device = iface->interface;
+    }
+    return TRUE;
+}
+
+/* of the static interfaces, the one with the longest subnet that
+ * holds addr */
+LobsterInterface *
+lobster_interface_get_from_address (const LobsterAddress *addr)
+{
+    guint index;
+    return lobster_trie_lookup (columns_trie (), addr, &index) ? lobster_interface_get_nth (index) : NULL;
 }
 
 LobsterInterface *
 lobster_interface_get_selected (void)
 {
     int active = gtk_combo_box_get_active (GTK_COMBO_BOX (WIDGET ("connection_list")));
-    return active != -1 ? g_list_nth_data (lobster.interfaces, active) : NULL;
+    return active != -1 ? lobster_interface_get_nth (active) : NULL;
 }
 
 gboolean
@@ -727,15 +3356,44 @@ void
 lobster_interface_display_selected (void)
 {
     LobsterInterface *iface = lobster_interface_get_selected ();
+    LobsterSnapshot *draft;
+    GError *error = NULL;
+    char *address;
+    char *subnet;
+    char *dns;
+
+    /* shown as it would be without an ifcfg file if it can't be read */
+    if (iface && !interface_ensure_loaded (iface, &error)) {
+        lobster_show_error (_("<b>Could not load interface configuration:</b>"), error);
+        g_error_free (error);
+    }
+    iface = lobster_interface_get_selected ();
+    address = iface ? lobster_address_to_string (&iface->address, FALSE) : NULL;
+    subnet = iface ? lobster_address_prefix_to_string (&iface->address) : NULL;
+    dns = iface ? lobster_resolver_to_string (published->resolver) : NULL;
 
     lobster_ignore_edits ();
 
+    /* unparsable text that was typed is replaced by the last good
+     * value, so the entries and the model agree again */
+    if (iface && (iface->address_invalid || iface->subnet_invalid)) {
+        draft = snapshot_draft ();
+        iface = snapshot_edit_interface (draft, iface->index);
+        iface->address_invalid = iface->subnet_invalid = FALSE;
+        snapshot_publish (draft);
+        columns_update (iface);
+    }
+
     TOGGLED ("enable_toggle", iface ? iface->enabled : FALSE);
     TOGGLED ("dhcp_toggle", iface ? iface->dhcp : TRUE);
-    TEXT ("address_entry", iface ? iface->address : "");
-    TEXT ("subnet_entry", iface ? iface->subnet : "");
-    TEXT ("router_entry", iface ? lobster.router : "");
-    TEXT ("dns_text", iface ? lobster.dns_servers : "");
+    TEXT ("address_entry", address);
+    TEXT ("subnet_entry", subnet);
+    TEXT ("router_entry", iface ? published->router : "");
+    TEXT ("dns_text", iface ? dns : "");
 
     lobster_accept_edits ();
+
+    g_free (address);
+    g_free (subnet);
+    g_free (dns);
 }
@@ -6,6 +6,8 @@
 G_BEGIN_DECLS
 
 typedef struct _LobsterSystem LobsterSystem;
+typedef struct _LobsterSnapshot LobsterSnapshot;
+typedef struct _LobsterInterfaceChunk LobsterInterfaceChunk;
 typedef struct _LobsterInterface LobsterInterface;
 
 G_END_DECLS
@@ -15,53 +17,165 @@ G_END_DECLS
 #include <glib/gmain.h>
 #include <gtk/gtkwidget.h>
 
+#include "lobsterio.h"
+#include "lobsteraddr.h"
+#include "lobsterarena.h"
+#include "lobsterresolv.h"
+#include "lobsterroute.h"
+
 G_BEGIN_DECLS
 
+/* bits of LobsterSnapshot.dirty */
+typedef enum {
+    LOBSTER_SYSTEM_DNS_SERVERS = 1 << 0,
+    LOBSTER_SYSTEM_ROUTER      = 1 << 1,
+    LOBSTER_SYSTEM_USE_NM      = 1 << 2,
+    LOBSTER_SYSTEM_DNS_SEARCH  = 1 << 3,
+    LOBSTER_SYSTEM_DNS_OPTIONS = 1 << 4
+} LobsterSystemField;
+
+/* bits of LobsterInterface.dirty */
+typedef enum {
+    LOBSTER_INTERFACE_ADDRESS  = 1 << 0,
+    LOBSTER_INTERFACE_SUBNET   = 1 << 1,
+    LOBSTER_INTERFACE_ENABLED  = 1 << 2,
+    LOBSTER_INTERFACE_DHCP     = 1 << 3
+} LobsterInterfaceField;
+
 struct _LobsterSystem {
     GtkWidget  *dialog;
-    GList      *interfaces;
-    char       *dns_servers;
-    char       *router;
 
     int ignore_edits;
+    /* milliseconds a save waits for others to share its run */
+    guint save_window;
+};
+
+/*
+ * A generation of the model.  Once published a snapshot never changes,
+ * so any thread holding a reference can read it without locks; edits
+ * make a new generation that shares every interface they didn't touch.
+ */
+struct _LobsterSnapshot {
+    gint        ref_count;
+    guint       generation;
+    /* holds the strings and interfaces of the load the snapshot
+     * descends from */
+    LobsterArena *arena;
+    /* what this generation's edits were made in, NULL until it has
+     * any; what lives on in later generations holds a reference */
+    LobsterArena *edits;
+    /* the edits arena holding resolver and router, NULL if they are
+     * as loaded */
+    LobsterArena *system_arena;
+    LobsterInterfaceChunk **chunks; /* see lobster_snapshot_get_nth() */
+    guint       n_interfaces;       /* in device order */
+    GHashTable *interfaces_by_name; /* index + 1, shared while the devices are */
+    const LobsterResolver *resolver;
+    /* the routes file as loaded, which edits to the default route's
+     * gateway in router override */
+    const LobsterRouteTable *routes;
+    char       *router;
 
     gboolean    use_nm;
-    gboolean    dirty;
+    guint       dirty;      /* fields that differ from what was loaded */
 };
 
 struct _LobsterInterface {
+    gint      ref_count;
+    /* the edits arena of the generation that copied it, which it
+     * holds; NULL if it was made in the snapshot's arena */
+    LobsterArena *arena;
+    guint     id;           /* stays the same across reloads */
+    guint     index;        /* in device order */
     char     *interface;
-    char     *address;
-    char     *subnet;
-
-    gboolean  enabled;
-    gboolean  dhcp;
-
-    gboolean  dirty;
+    /* IPADDR, with the prefix from it or from NETMASK */
+    LobsterAddress address;
+
+    /* carried through a save unchanged */
+    char       *mtu;
+    char       *ethtool_options;
+    char       *lladdr;
+    GHashTable *extra;          /* IPADDR_x and friends, by full key */
+    /* the devices this one is stacked on, from ETHERDEVICE,
+     * BONDING_SLAVEx and BRIDGE_PORTS; NULL terminated, or NULL */
+    char      **lower;
+
+    guint     enabled : 1;
+    guint     dhcp : 1;
+    guint     cidr : 1;             /* IPADDR carries the prefix */
+    /* the text in the file or entry didn't parse, so address holds
+     * the value before it */
+    guint     address_invalid : 1;
+    guint     subnet_invalid : 1;
+    /* a stand-in with only the name until the ifcfg file is read; see
+     * lobster_system_ensure_loaded() */
+    guint     loaded : 1;
+    /* why a stand-in's file couldn't be read, which it isn't again
+     * until it is shown; NULL otherwise */
+    const char *load_error;
+
+    guint     dirty;
+    /* the fields as loaded or last saved, to diff edits against */
+    const LobsterInterface *saved;
 };
 
 extern LobsterSystem lobster;
 
+/* how a save ends: error is NULL if it was written and applied, and
+ * belongs to the save; merged is how many saves shared the run, this
+ * one included, and they all get the same error */
+typedef void (*LobsterSaveFunc) (GError *error, guint merged, gpointer data);
+
 void     lobster_show_error (const char *doing, GError *error);
 
 void     lobster_ignore_edits (void);
 void     lobster_accept_edits (void);
 
+/* _load_devices() leaves the ifcfg files to be read as they are
+ * needed; anything that works on every interface must call
+ * _ensure_loaded() first */
 gboolean lobster_system_load (GError **error);
-gboolean lobster_system_save (GError **error);
+gboolean lobster_system_load_devices (GError **error);
+gboolean lobster_system_ensure_loaded (GError **error);
+/* writes the edits and applies them from the main loop, together with
+ * any other saves within lobster.save_window; func is called once that
+ * is over, never before this returns */
+void     lobster_system_save (LobsterSaveFunc func, gpointer data);
 void     lobster_system_display (void);
+/* the gateway (no family if on link) and device that traffic to addr
+ * would take with the edits so far; needs every interface loaded */
+gboolean lobster_system_route (const LobsterAddress *addr, LobsterAddress *gateway, const char **device);
 
 void     lobster_system_dirty    (void);
 void     lobster_interface_dirty (void);
 gboolean lobster_is_dirty        (void);
 gboolean lobster_is_valid        (void);
 
+/* step through edits; FALSE if there was nothing to step through */
+gboolean lobster_undo (void);
+gboolean lobster_redo (void);
+
 gboolean lobster_interface_load (const char *interface, GError **error);
-gboolean lobster_interface_save (LobsterInterface *iface, GError **error);
-void     lobster_interface_free (LobsterInterface *iface);
+gboolean lobster_interface_save (LobsterInterface *iface, LobsterIOTransaction *tx, GError **error);
 gboolean lobster_interface_renew (GError **error);
 
+/* any thread may take a reference to the published snapshot; only the
+ * main thread publishes */
+LobsterSnapshot  *lobster_snapshot_get   (void);
+LobsterSnapshot  *lobster_snapshot_ref   (LobsterSnapshot *snap);
+void              lobster_snapshot_unref (LobsterSnapshot *snap);
+LobsterInterface *lobster_snapshot_get_nth (LobsterSnapshot *snap, guint index);
+LobsterInterface *lobster_snapshot_get_from_device (LobsterSnapshot *snap, const char *interface);
+
+LobsterInterface *lobster_interface_ref   (LobsterInterface *iface);
+void              lobster_interface_unref (LobsterInterface *iface);
+
+/* these look at the published snapshot, for the main thread */
+guint             lobster_interface_count (void);
+LobsterInterface *lobster_interface_get_nth (guint index);
+LobsterInterface *lobster_interface_get_from_id (guint id);
 LobsterInterface *lobster_interface_get_from_device (const char *interface);
+LobsterInterface *lobster_interface_get_from_address (const LobsterAddress *addr);
 LobsterInterface *lobster_interface_get_selected (void);
 void              lobster_interface_display_selected (void);
 
@@ -93,6 +207,8 @@ char *lobster_text_view_text (const char *name);
 #define ISENABLED(w) (GTK_WIDGET_IS_SENSITIVE (WIDGET (w)))
 #define VISIBLE(w, v) (((v) ? gtk_widget_show : gtk_widget_hide) (WIDGET (w)))
 #define STARTSWITH(s1,s2) (0 == strncmp (s1, s2, strlen (s2)))
+/* for (pointer, length) slices; s2 must be a string literal */
+#define STARTSWITH_LEN(s1,len,s2) ((len) >= sizeof (s2) - 1 && 0 == memcmp (s1, s2, sizeof (s2) - 1))
 
 #ifndef g_timeout_add_seconds
 #define g_timeout_add_seconds(interval,function,data) g_timeout_add((interval)*1000,(function),(data))
@@ -0,0 +1,225 @@
+/*
+ * Checks lobster_address_parse() against inet_pton() on generated
+ * addresses, well formed and mangled, and the netmask helpers against
+ * a shift, then times both parsers over the same strings.  Any
+ * disagreement is printed and fails the run.
+ *
+ * usage: lobsteraddr-bench [addresses [seed]]
+ */
+
+#include "config.h"
+
+#include "lobsteraddr.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static GRand *rnd;
+
+static void
+append_ipv4 (GString *buf)
+{
+    g_string_append_printf (buf, "%u.%u.%u.%u",
+                            g_rand_int_range (rnd, 0, 256), g_rand_int_range (rnd, 0, 256),
+                            g_rand_int_range (rnd, 0, 256), g_rand_int_range (rnd, 0, 256));
+}
+
+/* eight groups, some runs of them maybe squashed to ::, maybe ending
+ * in a dotted quad */
+static void
+append_ipv6 (GString *buf)
+{
+    guint groups = g_rand_boolean (rnd) ? 8 : 6;
+    guint skip_from = g_rand_int_range (rnd, 0, groups + 1);
+    guint skip_to = g_rand_int_range (rnd, skip_from, groups + 1);
+    guint i;
+
+    for (i = 0; i < groups; i++) {
+        if (i >= skip_from && i < skip_to) {
+            if (i == skip_from) {
+                g_string_append (buf, i ? ":" : "::");
+            }
+            continue;
+        }
+        g_string_append_printf (buf, g_rand_boolean (rnd) ? "%x" : "%04x",
+                                g_rand_boolean (rnd) ? g_rand_int_range (rnd, 0, 0x10000) : 0);
+        if (i + 1 < groups || groups == 6) {
+            g_string_append_c (buf, ':');
+        }
+    }
+    if (groups == 6) {
+        append_ipv4 (buf);
+    }
+}
+
+/* replaces, inserts or deletes a character */
+static void
+mangle (GString *buf)
+{
+    static const char chars[] = "0123456789abcdefABCDEFg:.:.0 x/";
+    guint pos = g_rand_int_range (rnd, 0, buf->len + 1);
+    char c = chars[g_rand_int_range (rnd, 0, sizeof (chars) - 1)];
+
+    switch (g_rand_int_range (rnd, 0, 3)) {
+    case 0:
+        if (pos < buf->len) {
+            buf->str[pos] = c;
+            break;
+        }
+        /* fall through */
+    case 1:
+        g_string_insert_c (buf, pos, c);
+        break;
+    default:
+        if (pos < buf->len) {
+            g_string_erase (buf, pos, 1);
+        }
+        break;
+    }
+}
+
+static char **
+make_addresses (guint n)
+{
+    char **addrs = g_new (char *, n + 1);
+    GString *buf = g_string_new (NULL);
+    guint i, j;
+
+    for (i = 0; i < n; i++) {
+        g_string_truncate (buf, 0);
+        if (g_rand_boolean (rnd)) {
+            append_ipv4 (buf);
+        } else {
+            append_ipv6 (buf);
+        }
+        for (j = g_rand_int_range (rnd, 0, 4); j < 2; j++) {
+            mangle (buf);
+        }
+        addrs[i] = g_strdup (buf->str);
+    }
+    addrs[n] = NULL;
+    g_string_free (buf, TRUE);
+    return addrs;
+}
+
+static gboolean
+pton (const char *str, LobsterAddress *addr)
+{
+    lobster_address_clear (addr);
+    addr->family = strchr (str, ':') ? AF_INET6 : AF_INET;
+    /* inet_pton() has no prefixes, and would stop at a nul */
+    return !strchr (str, '/') && inet_pton (addr->family, str, addr->bytes) == 1;
+}
+
+static guint
+check_addresses (char **addrs)
+{
+    LobsterAddress ours, theirs;
+    gboolean ok, had_prefix;
+    guint bad = 0, valid = 0, i;
+
+    for (i = 0; addrs[i]; i++) {
+        lobster_address_clear (&ours);
+        ok = lobster_address_parse (&ours, addrs[i], strlen (addrs[i]), &had_prefix) && !had_prefix;
+        if (ok != pton (addrs[i], &theirs) || (ok && !lobster_address_equal (&ours, &theirs))) {
+            if (bad++ < 10) {
+                fprintf (stderr, "lobsteraddr-bench: %s: parsed %s, inet_pton %s\n",
+                         addrs[i], ok ? "ok" : "bad", ok ? "disagrees" : "ok");
+            }
+        }
+        valid += ok;
+    }
+    printf ("checked %u addresses, %u valid\n", i, valid);
+    return bad;
+}
+
+static guint
+check_masks (void)
+{
+    guint8 mask[16], expect[16];
+    guint bad = 0, prefix, i;
+    int got;
+
+    for (prefix = 0; prefix <= 128; prefix++) {
+        for (i = 0; i < 16; i++) {
+            expect[i] = prefix >= 8 * (i + 1) ? 0xff : prefix <= 8 * i ? 0 : (guint8)(0xff << (8 * (i + 1) - prefix));
+        }
+        lobster_address_prefix_to_mask (prefix, mask, 16);
+        got = lobster_address_mask_to_prefix (mask, 16);
+        if (memcmp (mask, expect, 16) || got != (int)prefix) {
+            fprintf (stderr, "lobsteraddr-bench: /%u: mask or prefix %d wrong\n", prefix, got);
+            bad++;
+        }
+        /* a one after the zeros makes it a mask no more */
+        if (prefix < 127) {
+            mask[15] |= 1;
+            if (lobster_address_mask_to_prefix (mask, 16) != -1) {
+                fprintf (stderr, "lobsteraddr-bench: /%u with a stray bit passed\n", prefix);
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+static void
+time_parsers (char **addrs, guint n, guint rounds)
+{
+    LobsterAddress addr;
+    GTimer *timer = g_timer_new ();
+    guint ok = 0, i, r;
+    double ours, theirs;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            lobster_address_clear (&addr);
+            ok += lobster_address_parse (&addr, addrs[i], strlen (addrs[i]), NULL);
+        }
+    }
+    ours = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            ok += pton (addrs[i], &addr);
+        }
+    }
+    theirs = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    printf ("lobster_address_parse: %6.1f ns/address\n", ours * 1e9 / ((double)n * rounds));
+    printf ("inet_pton:             %6.1f ns/address   (%u)\n", theirs * 1e9 / ((double)n * rounds), ok);
+}
+
+int
+main (int argc, char *argv[])
+{
+    guint n = argc > 1 ? atoi (argv[1]) : 1000000;
+    guint32 seed = argc > 2 ? strtoul (argv[2], NULL, 0) : 1;
+    char **addrs;
+    guint bad;
+
+    rnd = g_rand_new_with_seed (seed);
+    addrs = make_addresses (n);
+
+    bad = check_addresses (addrs) + check_masks ();
+    if (!bad) {
+        time_parsers (addrs, n, MAX (1, 10000000 / MAX (n, 1)));
+    }
+
+    g_strfreev (addrs);
+    g_rand_free (rnd);
+    if (bad) {
+        fprintf (stderr, "lobsteraddr-bench: %u mismatches (seed %u)\n", bad, seed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "config.h"
+
+#include "lobsteraddr.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* big enough for any address with a prefix, or a netmask */
+#define MAX_TEXT (INET6_ADDRSTRLEN + 4)
+
+void
+lobster_address_clear (LobsterAddress *addr)
+{
+    memset (addr, 0, sizeof (*addr));
+    addr->family = AF_UNSPEC;
+    addr->prefix = LOBSTER_ADDRESS_NO_PREFIX;
+}
+
+static guint
+max_prefix (int family)
+{
+    return family == AF_INET6 ? 128 : 32;
+}
+
+/* returns the number, or -1 */
+static int
+parse_prefix_len (const char *str, gsize len, guint max)
+{
+    guint val = 0;
+    gsize i;
+
+    if (!len || len > 3) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        if (!g_ascii_isdigit (str[i])) {
+            return -1;
+        }
+        val = val * 10 + (str[i] - '0');
+    }
+    return val <= max ? (int)val : -1;
+}
+
+/*
+ * The parsers below accept exactly what glibc's inet_pton() does, which
+ * lobsteraddr-bench checks, but work on counted text in one pass with
+ * no copy: dotted quads of decimal parts up to 255 without leading
+ * zeros, and IPv6 groups of up to four hex digits with at most one ::
+ * and an optional dotted quad at the end.
+ */
+
+/* hex digit values plus one, 0 for anything else */
+static const guint8 hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/* the decimal digit at p, or 10 at the end */
+#define DIGIT(p, end) ((p) < (end) ? (guint)(guchar)*(p) - '0' : 10)
+
+static gboolean
+parse_ipv4 (const char *p, const char *end, guint8 *out)
+{
+    guint octet, d, i;
+
+    for (i = 0; i < 4; i++) {
+        if (i && (p == end || *p++ != '.')) {
+            return FALSE;
+        }
+        if ((octet = DIGIT (p, end)) > 9) {
+            return FALSE;
+        }
+        p++;
+        /* up to two more digits, unless the first was a 0 */
+        if (octet && (d = DIGIT (p, end)) < 10) {
+            octet = octet * 10 + d;
+            p++;
+            if ((d = DIGIT (p, end)) < 10) {
+                octet = octet * 10 + d;
+                p++;
+            }
+        }
+        if (octet > 255) {
+            return FALSE;
+        }
+        out[i] = octet;
+    }
+    return p == end;
+}
+
+static gboolean
+parse_ipv6 (const char *p, const char *end, guint8 *out)
+{
+    guint8 *tp = out, *endp = out + 16, *colonp = NULL;
+    const char *group;
+    guint val = 0, digits = 0;
+    gsize n;
+    guint x;
+
+    memset (out, 0, 16);
+    /* only a :: can come first */
+    if (p < end && *p == ':' && (++p == end || *p != ':')) {
+        return FALSE;
+    }
+    for (group = p; p < end; p++) {
+        if ((x = hex_digits[(guchar)*p])) {
+            if (++digits > 4) {
+                return FALSE;
+            }
+            val = val << 4 | (x - 1);
+        } else if (*p == ':') {
+            group = p + 1;
+            if (!digits) {
+                if (colonp) {
+                    return FALSE;
+                }
+                colonp = tp;
+                continue;
+            }
+            if (p + 1 == end || tp + 2 > endp) {
+                return FALSE;
+            }
+            *tp++ = val >> 8;
+            *tp++ = val;
+            val = digits = 0;
+        } else if (*p == '.' && tp + 4 <= endp) {
+            if (!parse_ipv4 (group, end, tp)) {
+                return FALSE;
+            }
+            tp += 4;
+            digits = 0;
+            break;
+        } else {
+            return FALSE;
+        }
+    }
+    if (digits) {
+        if (tp + 2 > endp) {
+            return FALSE;
+        }
+        *tp++ = val >> 8;
+        *tp++ = val;
+    }
+    /* :: stands for at least one group of zeros */
+    if (colonp) {
+        if (tp == endp) {
+            return FALSE;
+        }
+        n = tp - colonp;
+        memmove (endp - n, colonp, n);
+        memset (colonp, 0, endp - n - colonp);
+        tp = endp;
+    }
+    return tp == endp;
+}
+
+gboolean
+lobster_address_parse (LobsterAddress *addr, const char *str, gsize len, gboolean *had_prefix)
+{
+    const char *slash, *end = str, *stop = str + len;
+    gboolean colon = FALSE;
+    guint8 bytes[16];
+    int family, prefix = -1;
+
+    /* the family and the end of the address in one look */
+    for (; end < stop && *end != '/'; end++) {
+        colon |= *end == ':';
+    }
+    slash = end < stop ? end : NULL;
+    if (end == str) {
+        return FALSE;
+    }
+    if (colon) {
+        family = AF_INET6;
+        if (!parse_ipv6 (str, end, bytes)) {
+            return FALSE;
+        }
+    } else {
+        family = AF_INET;
+        if (!parse_ipv4 (str, end, bytes)) {
+            return FALSE;
+        }
+    }
+    if (slash && (prefix = parse_prefix_len (slash + 1, str + len - slash - 1, max_prefix (family))) < 0) {
+        return FALSE;
+    }
+
+    memset (addr->bytes, 0, sizeof (addr->bytes));
+    memcpy (addr->bytes, bytes, family == AF_INET6 ? 16 : 4);
+    addr->family = family;
+    if (slash) {
+        addr->prefix = prefix;
+    }
+    if (had_prefix) {
+        *had_prefix = slash != NULL;
+    }
+    return TRUE;
+}
+
+int
+lobster_address_mask_to_prefix (const guint8 *mask, gsize len)
+{
+    guint prefix = 0;
+    guint8 rest;
+    gsize i;
+
+    for (i = 0; i < len && mask[i] == 0xff; i++) {
+        prefix += 8;
+    }
+    if (i == len) {
+        return prefix;
+    }
+    /* the ones must be contiguous: the rest of the byte is then one
+     * less than a power of two */
+    rest = ~mask[i];
+    if (rest & (rest + 1)) {
+        return -1;
+    }
+    prefix += 8 - g_bit_storage (rest);
+    for (i++; i < len; i++) {
+        if (mask[i]) {
+            return -1;
+        }
+    }
+    return prefix;
+}
+
+void
+lobster_address_prefix_to_mask (guint prefix, guint8 *mask, gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; i++) {
+        mask[i] = prefix >= 8 ? 0xff : (guint8)(0xff00 >> prefix);
+        prefix -= MIN (prefix, 8);
+    }
+}
+
+gboolean
+lobster_address_parse_prefix (LobsterAddress *addr, const char *str, gsize len)
+{
+    guint8 mask[4];
+    int prefix;
+
+    if (len && *str == '/') {
+        str++;
+        len--;
+    }
+    prefix = parse_prefix_len (str, len, max_prefix (addr->family));
+    if (prefix >= 0) {
+        addr->prefix = prefix;
+        return TRUE;
+    }
+
+    if (addr->family == AF_INET6 || !parse_ipv4 (str, str + len, mask) ||
+        (prefix = lobster_address_mask_to_prefix (mask, sizeof (mask))) < 0) {
+        return FALSE;
+    }
+    addr->prefix = prefix;
+    return TRUE;
+}
+
+gboolean
+lobster_address_equal (const LobsterAddress *a, const LobsterAddress *b)
+{
+    return a->family == b->family && !memcmp (a->bytes, b->bytes, sizeof (a->bytes));
+}
+
+char *
+lobster_address_to_string (const LobsterAddress *addr, gboolean with_prefix)
+{
+    char buf[MAX_TEXT];
+
+    if (addr->family == AF_UNSPEC || !inet_ntop (addr->family, addr->bytes, buf, sizeof (buf))) {
+        return g_strdup ("");
+    }
+    if (with_prefix && addr->prefix != LOBSTER_ADDRESS_NO_PREFIX) {
+        return g_strdup_printf ("%s/%u", buf, addr->prefix);
+    }
+    return g_strdup (buf);
+}
+
+char *
+lobster_address_prefix_to_string (const LobsterAddress *addr)
+{
+    guint8 mask[4];
+
+    if (addr->prefix == LOBSTER_ADDRESS_NO_PREFIX) {
+        return g_strdup ("");
+    }
+    if (addr->family == AF_INET6 || addr->prefix > 32) {
+        return g_strdup_printf ("%u", addr->prefix);
+    }
+    lobster_address_prefix_to_mask (addr->prefix, mask, sizeof (mask));
+    return g_strdup_printf ("%u.%u.%u.%u", mask[0], mask[1], mask[2], mask[3]);
+}
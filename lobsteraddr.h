@@ -0,0 +1,49 @@
+#ifndef LOBSTER_ADDR_H
+#define LOBSTER_ADDR_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterAddress LobsterAddress;
+
+#define LOBSTER_ADDRESS_NO_PREFIX 0xff
+
+/* family is AF_INET, AF_INET6, or AF_UNSPEC for no address; the prefix
+ * is kept even without an address, since it is edited separately */
+struct _LobsterAddress {
+    guint8  family;
+    guint8  prefix;
+    guint8  bytes[16];      /* network order */
+};
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+void     lobster_address_clear     (LobsterAddress *addr);
+
+/* parses an address with an optional /prefix, which sets *had_prefix if
+ * not NULL; the prefix is left alone if there is none */
+gboolean lobster_address_parse     (LobsterAddress *addr, const char *str, gsize len, gboolean *had_prefix);
+/* parses a dotted IPv4 netmask or a prefix length, with or without a
+ * leading slash */
+gboolean lobster_address_parse_prefix (LobsterAddress *addr, const char *str, gsize len);
+
+/* the prefix length of a netmask of len bytes, or -1 if its ones
+ * aren't contiguous */
+int      lobster_address_mask_to_prefix (const guint8 *mask, gsize len);
+void     lobster_address_prefix_to_mask (guint prefix, guint8 *mask, gsize len);
+
+gboolean lobster_address_equal     (const LobsterAddress *a, const LobsterAddress *b);
+
+/* "" for no address; with_prefix appends /prefix if there is one */
+char    *lobster_address_to_string (const LobsterAddress *addr, gboolean with_prefix);
+/* a dotted netmask for IPv4 (or no family), the prefix length for IPv6,
+ * "" for no prefix */
+char    *lobster_address_prefix_to_string (const LobsterAddress *addr);
+
+G_END_DECLS
+
+#endif /* LOBSTER_ADDR_H */
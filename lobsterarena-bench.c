@@ -0,0 +1,202 @@
+/*
+ * Counts the allocator calls and peak RSS of parsing a host's worth of
+ * ifcfg files into records with heap strings, as the model used to,
+ * and into a load arena with interning.  Each mode runs in its own
+ * child so the peak RSS figures don't include each other.
+ *
+ * usage: lobsterarena-bench [interfaces]
+ */
+
+#include "config.h"
+
+#include "lobsterarena.h"
+#include "lobsterschema.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef __GLIBC__
+/* count every call that reaches the C allocator, glib's included */
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t n, size_t size);
+extern void *__libc_realloc (void *p, size_t size);
+extern void  __libc_free    (void *p);
+
+static gsize n_allocs;
+static gsize n_frees;
+
+void *
+malloc (size_t size)
+{
+    n_allocs++;
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+    n_allocs++;
+    return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *p, size_t size)
+{
+    n_allocs++;
+    return __libc_realloc (p, size);
+}
+
+void
+free (void *p)
+{
+    if (p) {
+        n_frees++;
+    }
+    __libc_free (p);
+}
+#else
+static gsize n_allocs;
+static gsize n_frees;
+#endif
+
+typedef struct {
+    char       *name;
+    char       *startmode;
+    char       *bootproto;
+    char       *address;
+    char       *netmask;
+    char       *mtu;
+    char       *ethtool_options;
+    char       *lladdr;
+    GHashTable *extra;
+} Record;
+
+#define STRING_KEY(name, flags, field) \
+    { name, LOBSTER_SCHEMA_STRING, (flags), G_STRUCT_OFFSET (Record, field) }
+
+static LobsterSchemaKey keys[] = {
+    STRING_KEY ("STARTMODE",       LOBSTER_SCHEMA_INTERN, startmode),
+    STRING_KEY ("BOOTPROTO",       LOBSTER_SCHEMA_INTERN, bootproto),
+    STRING_KEY ("IPADDR",          0,                     address),
+    STRING_KEY ("NETMASK",         LOBSTER_SCHEMA_INTERN, netmask),
+    STRING_KEY ("MTU",             LOBSTER_SCHEMA_INTERN, mtu),
+    STRING_KEY ("ETHTOOL_OPTIONS", 0,                     ethtool_options),
+    STRING_KEY ("LLADDR",          0,                     lladdr),
+    { "IPADDR_", LOBSTER_SCHEMA_TABLE, LOBSTER_SCHEMA_PREFIX, G_STRUCT_OFFSET (Record, extra) },
+    { "LABEL_",  LOBSTER_SCHEMA_TABLE, LOBSTER_SCHEMA_PREFIX | LOBSTER_SCHEMA_INTERN, G_STRUCT_OFFSET (Record, extra) },
+};
+
+static LobsterSchema schema = LOBSTER_SCHEMA_INIT (LOBSTER_SCHEMA_ASSIGN, '\'', keys);
+
+/* the files of n interfaces, one string of lines each */
+static char **
+make_files (guint n)
+{
+    char **files = g_new (char *, n + 1);
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        files[i] = g_strdup_printf ("STARTMODE='auto'\n"
+                                    "BOOTPROTO='static'\n"
+                                    "IPADDR='10.%u.%u.1'\n"
+                                    "NETMASK='255.255.255.0'\n"
+                                    "MTU='1500'\n"
+                                    "ETHTOOL_OPTIONS='-K eth%u tso off'\n"
+                                    "LLADDR='02:00:00:00:%02x:%02x'\n"
+                                    "IPADDR_1='10.%u.%u.2'\n"
+                                    "LABEL_1='1'\n",
+                                    (i >> 8) & 0xff, i & 0xff, i, (i >> 8) & 0xff, i & 0xff,
+                                    (i >> 8) & 0xff, i & 0xff);
+    }
+    files[n] = NULL;
+    return files;
+}
+
+static void
+parse_file (const char *text, Record *record, LobsterArena *arena)
+{
+    const char *eol;
+
+    for (; *text; text = eol + 1) {
+        eol = strchr (text, '\n');
+        lobster_schema_read_line (&schema, text, eol - text, record, arena);
+    }
+}
+
+static void
+run (char **files, guint n, gboolean use_arena)
+{
+    LobsterArena *arena = use_arena ? lobster_arena_new () : NULL;
+    Record *records;
+    char name[32];
+    gsize allocs = n_allocs, frees = n_frees;
+    GTimer *timer = g_timer_new ();
+    struct rusage usage;
+    double load, drop;
+    guint i;
+
+    records = arena ? lobster_arena_alloc0 (arena, n * sizeof (Record)) : g_new0 (Record, n);
+    for (i = 0; i < n; i++) {
+        g_snprintf (name, sizeof (name), "eth%u", i);
+        records[i].name = arena ? lobster_arena_strndup (arena, name, strlen (name)) : g_strdup (name);
+        parse_file (files[i], &records[i], arena);
+    }
+    load = g_timer_elapsed (timer, NULL);
+    printf ("%-5s load: %8" G_GSIZE_FORMAT " allocs %8.1f ms\n",
+            use_arena ? "arena" : "heap", n_allocs - allocs, load * 1000);
+
+    allocs = n_allocs;
+    frees = n_frees;
+    g_timer_start (timer);
+    for (i = 0; i < n; i++) {
+        lobster_schema_clear (&schema, &records[i], arena);
+        if (!arena) {
+            g_free (records[i].name);
+        }
+    }
+    if (arena) {
+        lobster_arena_unref (arena);
+    } else {
+        g_free (records);
+    }
+    drop = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    getrusage (RUSAGE_SELF, &usage);
+    printf ("%-5s drop: %8" G_GSIZE_FORMAT " frees  %8.1f ms   peak rss %ld KB\n",
+            use_arena ? "arena" : "heap", n_frees - frees, drop * 1000, usage.ru_maxrss);
+}
+
+int
+main (int argc, char *argv[])
+{
+    guint n = argc > 1 ? atoi (argv[1]) : 10000;
+    int mode, status;
+    pid_t pid;
+
+    for (mode = 0; mode < 2; mode++) {
+        fflush (stdout);
+        pid = fork ();
+        if (pid < 0) {
+            perror ("lobsterarena-bench: fork");
+            return 1;
+        } else if (pid == 0) {
+            char **files = make_files (n);
+            run (files, n, mode);
+            fflush (stdout);
+            _exit (0);
+        }
+        if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status)) {
+            fprintf (stderr, "lobsterarena-bench: run failed\n");
+            return 1;
+        }
+    }
+    return 0;
+}
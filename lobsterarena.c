@@ -0,0 +1,147 @@
+#include "config.h"
+
+#include "lobsterarena.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+/*
+ * Allocations are carved from the head of a list of blocks.  One too
+ * big to share a block gets a block of its own, which becomes the new
+ * head, so the most recent allocation is always at the end of the
+ * head block and interning can hand it back when it turns out to be
+ * a duplicate.
+ */
+
+#define BLOCK_SIZE  (16 << 10)
+#define ALIGN(n)    (((n) + 7) & ~(gsize)7)
+
+typedef struct _Block Block;
+
+struct _Block {
+    Block  *next;
+    gsize   size;
+    gsize   used;
+    /* data follows, aligned by the union */
+    union {
+        gint64   i;
+        double   d;
+        gpointer p;
+    } data[1];
+};
+
+#define BLOCK_DATA(block) ((char *)(block)->data)
+
+struct _LobsterArena {
+    gint        ref_count;
+    GMutex      lock;
+    Block      *blocks;
+    GHashTable *interned;
+};
+
+LobsterArena *
+lobster_arena_new (void)
+{
+    LobsterArena *arena = g_new0 (LobsterArena, 1);
+    arena->ref_count = 1;
+    g_mutex_init (&arena->lock);
+    arena->interned = g_hash_table_new (g_str_hash, g_str_equal);
+    return arena;
+}
+
+LobsterArena *
+lobster_arena_ref (LobsterArena *arena)
+{
+    g_atomic_int_inc (&arena->ref_count);
+    return arena;
+}
+
+void
+lobster_arena_unref (LobsterArena *arena)
+{
+    Block *block, *next;
+
+    if (!arena || !g_atomic_int_dec_and_test (&arena->ref_count)) {
+        return;
+    }
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        g_free (block);
+    }
+    g_hash_table_destroy (arena->interned);
+    g_mutex_clear (&arena->lock);
+    g_free (arena);
+}
+
+static gpointer
+alloc_locked (LobsterArena *arena, gsize size)
+{
+    Block *block = arena->blocks;
+    gsize block_size;
+    char *p;
+
+    size = ALIGN (MAX (size, 1));
+    if (!block || block->size - block->used < size) {
+        block_size = MAX (BLOCK_SIZE, size);
+        block = g_malloc (G_STRUCT_OFFSET (Block, data) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    p = BLOCK_DATA (block) + block->used;
+    block->used += size;
+    return p;
+}
+
+gpointer
+lobster_arena_alloc0 (LobsterArena *arena, gsize size)
+{
+    gpointer p;
+
+    g_mutex_lock (&arena->lock);
+    p = alloc_locked (arena, size);
+    g_mutex_unlock (&arena->lock);
+
+    return memset (p, 0, size);
+}
+
+char *
+lobster_arena_strndup (LobsterArena *arena, const char *str, gsize len)
+{
+    char *p;
+
+    g_mutex_lock (&arena->lock);
+    p = alloc_locked (arena, len + 1);
+    g_mutex_unlock (&arena->lock);
+
+    memcpy (p, str, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *
+lobster_arena_intern (LobsterArena *arena, const char *str, gsize len)
+{
+    char *p, *found;
+
+    g_mutex_lock (&arena->lock);
+
+    /* copying first gives the lookup a terminated key without a
+     * temporary; a duplicate is then given back */
+    p = alloc_locked (arena, len + 1);
+    memcpy (p, str, len);
+    p[len] = '\0';
+
+    found = g_hash_table_lookup (arena->interned, p);
+    if (found) {
+        arena->blocks->used -= ALIGN (len + 1);
+        p = found;
+    } else {
+        g_hash_table_insert (arena->interned, p, p);
+    }
+
+    g_mutex_unlock (&arena->lock);
+    return p;
+}
@@ -0,0 +1,31 @@
+#ifndef LOBSTER_ARENA_H
+#define LOBSTER_ARENA_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterArena LobsterArena;
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* memory from an arena is only ever released all at once, when the
+ * last reference to it goes; any thread may allocate from it */
+LobsterArena *lobster_arena_new     (void);
+LobsterArena *lobster_arena_ref     (LobsterArena *arena);
+void          lobster_arena_unref   (LobsterArena *arena);
+
+gpointer      lobster_arena_alloc0  (LobsterArena *arena, gsize size);
+char         *lobster_arena_strndup (LobsterArena *arena, const char *str, gsize len);
+/* equal strings come back as the same pointer, which must not be
+ * written to */
+char         *lobster_arena_intern  (LobsterArena *arena, const char *str, gsize len);
+
+#define lobster_arena_new0(arena, type) ((type *)lobster_arena_alloc0 ((arena), sizeof (type)))
+
+G_END_DECLS
+
+#endif /* LOBSTER_ARENA_H */
@@ -0,0 +1,349 @@
+#include "config.h"
+
+#include "lobstercache.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+/*
+ * The cache file is read by mapping it and binary searching the entry
+ * table in place:
+ *
+ *   CacheHeader
+ *   CacheEntry[n_entries], sorted by path
+ *   paths and record data, referenced by offset from the file start
+ *
+ * Everything is in host byte order; a cache written on another
+ * machine fails the magic check and is ignored.
+ */
+
+#define CACHE_MAGIC   "LOBCACHE"
+#define CACHE_FORMAT  1
+
+/* sources changed this recently might change again within the same
+ * timestamp tick without it showing, so they are never cached */
+#define RACY_SECONDS  2
+
+typedef struct {
+    char    magic[8];
+    guint32 format;
+    guint32 version;
+    guint32 n_entries;
+    guint32 reserved;
+} CacheHeader;
+
+typedef struct {
+    guint64 dev;
+    guint64 ino;
+    guint64 size;
+    gint64  mtime_ns;
+    gint64  ctime_ns;
+} CacheKey;
+
+typedef struct {
+    CacheKey key;
+    guint32  path_offset;
+    guint32  path_len;
+    guint32  data_offset;
+    guint32  data_len;
+    guint64  checksum;
+} CacheEntry;
+
+/* an entry for the next version of the file */
+typedef struct {
+    char    *path;
+    CacheKey key;
+    gpointer data;
+    gsize    len;
+} NewEntry;
+
+struct _LobsterCache {
+    char              *file;
+    guint32            version;
+
+    const char        *map;
+    gsize              map_len;
+    const CacheEntry  *entries;
+    guint32            n_entries;
+
+    GHashTable        *next;
+    gboolean           stored;
+};
+
+static guint64
+fnv1a (guint64 hash, gconstpointer data, gsize len)
+{
+    const guchar *p = data;
+    while (len--) {
+        hash = (hash ^ *p++) * G_GUINT64_CONSTANT (0x100000001b3);
+    }
+    return hash;
+}
+
+static guint64
+entry_checksum (const CacheKey *key, const char *path, gsize path_len, gconstpointer data, gsize len)
+{
+    guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+    hash = fnv1a (hash, key, sizeof (*key));
+    hash = fnv1a (hash, path, path_len);
+    return fnv1a (hash, data, len);
+}
+
+static void
+make_key (CacheKey *key, const struct stat *st)
+{
+    memset (key, 0, sizeof (*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_ns = (gint64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    key->ctime_ns = (gint64)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+}
+
+static void
+new_entry_free (NewEntry *entry)
+{
+    g_free (entry->path);
+    g_free (entry->data);
+    g_free (entry);
+}
+
+static gboolean
+map_cache (LobsterCache *cache)
+{
+    const CacheHeader *header;
+    const CacheEntry *entry;
+    struct stat st;
+    guint32 i;
+    int fd;
+
+    fd = open (cache->file, O_RDONLY);
+    if (fd < 0) {
+        return FALSE;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < sizeof (CacheHeader)) {
+        close (fd);
+        return FALSE;
+    }
+    cache->map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (cache->map == MAP_FAILED) {
+        cache->map = NULL;
+        return FALSE;
+    }
+    cache->map_len = st.st_size;
+
+    header = (const CacheHeader *)cache->map;
+    if (memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) ||
+        header->format != CACHE_FORMAT ||
+        header->version != cache->version ||
+        header->n_entries > (cache->map_len - sizeof (CacheHeader)) / sizeof (CacheEntry)) {
+        fprintf (stderr, "%s: ignoring out of date cache\n", cache->file);
+        return FALSE;
+    }
+
+    cache->entries = (const CacheEntry *)(cache->map + sizeof (CacheHeader));
+    cache->n_entries = header->n_entries;
+
+    /* bounds are checked once here so lookups can trust offsets;
+     * checksums are checked per lookup */
+    for (i = 0, entry = cache->entries; i < cache->n_entries; i++, entry++) {
+        if (entry->path_offset > cache->map_len || entry->path_len > cache->map_len - entry->path_offset ||
+            entry->data_offset > cache->map_len || entry->data_len > cache->map_len - entry->data_offset) {
+            fprintf (stderr, "%s: ignoring damaged cache\n", cache->file);
+            cache->entries = NULL;
+            cache->n_entries = 0;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+LobsterCache *
+lobster_cache_open (const char *file, guint32 version)
+{
+    LobsterCache *cache = g_new0 (LobsterCache, 1);
+
+    cache->file = g_strdup (file);
+    cache->version = version;
+    cache->next = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)new_entry_free);
+
+    map_cache (cache);
+
+    return cache;
+}
+
+void
+lobster_cache_free (LobsterCache *cache)
+{
+    if (cache->map) {
+        munmap ((gpointer)cache->map, cache->map_len);
+    }
+    g_hash_table_destroy (cache->next);
+    g_free (cache->file);
+    g_free (cache);
+}
+
+static const CacheEntry *
+find_entry (LobsterCache *cache, const char *source)
+{
+    const CacheEntry *entry;
+    gsize len = strlen (source);
+    guint32 lo = 0, hi = cache->n_entries, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        entry = &cache->entries[mid];
+        cmp = memcmp (source, cache->map + entry->path_offset, MIN (len, entry->path_len));
+        if (!cmp) {
+            cmp = len < entry->path_len ? -1 : len > entry->path_len;
+        }
+        if (!cmp) {
+            return entry;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static void
+keep_entry (LobsterCache *cache, const char *source, const CacheKey *key, gconstpointer data, gsize len)
+{
+    NewEntry *entry = g_new (NewEntry, 1);
+    entry->path = g_strdup (source);
+    entry->key = *key;
+    /* g_memdup() is deprecated and g_memdup2() too new */
+    entry->data = g_malloc (len);
+    memcpy (entry->data, data, len);
+    entry->len = len;
+    g_hash_table_replace (cache->next, entry->path, entry);
+}
+
+gboolean
+lobster_cache_lookup (LobsterCache *cache, const char *source, const struct stat *st,
+                      gconstpointer *data, gsize *len)
+{
+    const CacheEntry *entry;
+    CacheKey key;
+
+    entry = cache->entries ? find_entry (cache, source) : NULL;
+    if (!entry) {
+        return FALSE;
+    }
+
+    make_key (&key, st);
+    if (memcmp (&key, &entry->key, sizeof (key)) ||
+        entry->checksum != entry_checksum (&entry->key, cache->map + entry->path_offset, entry->path_len,
+                                           cache->map + entry->data_offset, entry->data_len)) {
+        return FALSE;
+    }
+
+    *data = cache->map + entry->data_offset;
+    *len = entry->data_len;
+    keep_entry (cache, source, &key, *data, *len);
+    return TRUE;
+}
+
+void
+lobster_cache_store (LobsterCache *cache, const char *source, const struct stat *st,
+                     gconstpointer data, gsize len)
+{
+    CacheKey key;
+
+    if (MAX (st->st_mtime, st->st_ctime) + RACY_SECONDS > time (NULL)) {
+        fprintf (stderr, "%s: changed too recently to cache\n", source);
+        return;
+    }
+
+    make_key (&key, st);
+    keep_entry (cache, source, &key, data, len);
+    cache->stored = TRUE;
+}
+
+static gint
+compare_new_entries (gconstpointer a, gconstpointer b)
+{
+    return strcmp ((*(NewEntry **)a)->path, (*(NewEntry **)b)->path);
+}
+
+static void
+collect_entry (gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add (data, value);
+}
+
+gboolean
+lobster_cache_write (LobsterCache *cache, GError **error)
+{
+    CacheHeader header;
+    CacheEntry entry;
+    NewEntry *ne;
+    GPtrArray *entries;
+    GString *buf;
+    gsize offset;
+    char *dir;
+    gboolean ret;
+    guint i;
+
+    if (!cache->stored && g_hash_table_size (cache->next) == cache->n_entries) {
+        return TRUE;
+    }
+
+    entries = g_ptr_array_sized_new (g_hash_table_size (cache->next));
+    g_hash_table_foreach (cache->next, collect_entry, entries);
+    g_ptr_array_sort (entries, compare_new_entries);
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+    header.format = CACHE_FORMAT;
+    header.version = cache->version;
+    header.n_entries = entries->len;
+
+    buf = g_string_new (NULL);
+    g_string_append_len (buf, (const char *)&header, sizeof (header));
+
+    offset = sizeof (header) + entries->len * sizeof (CacheEntry);
+    for (i = 0; i < entries->len; i++) {
+        ne = g_ptr_array_index (entries, i);
+        memset (&entry, 0, sizeof (entry));
+        entry.key = ne->key;
+        entry.path_offset = offset;
+        entry.path_len = strlen (ne->path);
+        offset += entry.path_len;
+        entry.data_offset = offset;
+        entry.data_len = ne->len;
+        offset += ne->len;
+        entry.checksum = entry_checksum (&entry.key, ne->path, entry.path_len, ne->data, ne->len);
+        g_string_append_len (buf, (const char *)&entry, sizeof (entry));
+    }
+    for (i = 0; i < entries->len; i++) {
+        ne = g_ptr_array_index (entries, i);
+        g_string_append (buf, ne->path);
+        g_string_append_len (buf, ne->data, ne->len);
+    }
+    g_ptr_array_free (entries, TRUE);
+
+    /* the cache is disposable, so g_file_set_contents' atomic rename is
+     * all the safety it needs */
+    dir = g_path_get_dirname (cache->file);
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    ret = g_file_set_contents (cache->file, buf->str, buf->len, error);
+    g_string_free (buf, TRUE);
+
+    fprintf (stderr, "%s: wrote %u entries\n", cache->file, g_hash_table_size (cache->next));
+    return ret;
+}
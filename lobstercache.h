@@ -0,0 +1,35 @@
+#ifndef LOBSTER_CACHE_H
+#define LOBSTER_CACHE_H
+
+#include <glib/gmacros.h>
+#include <glib/gerror.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterCache LobsterCache;
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* a missing, damaged or out of date cache opens as an empty one;
+ * version is the caller's record format */
+LobsterCache *lobster_cache_open   (const char *file, guint32 version);
+void          lobster_cache_free   (LobsterCache *cache);
+
+/* data is only valid until the cache is freed */
+gboolean      lobster_cache_lookup (LobsterCache *cache, const char *source, const struct stat *st,
+                                    gconstpointer *data, gsize *len);
+void          lobster_cache_store  (LobsterCache *cache, const char *source, const struct stat *st,
+                                    gconstpointer data, gsize len);
+
+/* replaces the cache file with the entries looked up or stored since
+ * it was opened, if that differs from what was read */
+gboolean      lobster_cache_write  (LobsterCache *cache, GError **error);
+
+G_END_DECLS
+
+#endif /* LOBSTER_CACHE_H */
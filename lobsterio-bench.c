@@ -0,0 +1,133 @@
+/*
+ * Measures the line readers in lobsterio.c with every newline scanner
+ * the CPU supports, on small (ifcfg-sized), medium and huge files.
+ *
+ * usage: lobsterio-bench [huge-megabytes]
+ */
+
+#include "config.h"
+
+#include "lobsterio.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char *scanner_names[] = { "scalar", "sse2", "avx2" };
+
+static gboolean
+count_copied_line (const char *file, int line_no, char *line, gpointer data, GError **error)
+{
+    ++*(gsize *)data;
+    return TRUE;
+}
+
+static gboolean
+count_mapped_line (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error)
+{
+    ++*(gsize *)data;
+    return TRUE;
+}
+
+static char *
+make_routes_file (gsize size, GError **error)
+{
+    GString *buf = g_string_sized_new (size + 64);
+    char *file;
+    gboolean ret;
+    int fd;
+    guint i;
+
+    for (i = 0; buf->len < size; i++) {
+        g_string_append_printf (buf, "10.%u.%u.0 192.168.%u.1 255.255.255.0 eth%u\n",
+                                (i >> 8) & 0xff, i & 0xff, i & 0xff, i % 64);
+    }
+
+    fd = g_file_open_tmp ("lobsterio-bench-XXXXXX", &file, error);
+    if (fd < 0) {
+        g_string_free (buf, TRUE);
+        return NULL;
+    }
+    close (fd);
+
+    ret = g_file_set_contents (file, buf->str, buf->len, error);
+    g_string_free (buf, TRUE);
+    if (!ret) {
+        unlink (file);
+        g_free (file);
+        return NULL;
+    }
+    return file;
+}
+
+/* returns MB/s, or a negative number on error */
+static double
+run (const char *file, gsize size, int iterations, gboolean mapped, GError **error)
+{
+    GTimer *timer = g_timer_new ();
+    gsize lines = 0;
+    double elapsed;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(mapped
+              ? lobster_io_map_file (file, count_mapped_line, &lines, error)
+              : lobster_io_read_file (file, count_copied_line, &lines, error))) {
+            g_timer_destroy (timer);
+            return -1;
+        }
+    }
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return (double)size * iterations / (1 << 20) / elapsed;
+}
+
+static gboolean
+bench_size (const char *label, gsize size, int iterations, GError **error)
+{
+    char *file;
+    double copied, mapped;
+    int i;
+
+    file = make_routes_file (size, error);
+    if (!file) {
+        return FALSE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (scanner_names); i++) {
+        if (!lobster_io_set_scanner (scanner_names[i])) {
+            continue;
+        }
+        if ((copied = run (file, size, iterations, FALSE, error)) < 0 ||
+            (mapped = run (file, size, iterations, TRUE, error)) < 0) {
+            unlink (file);
+            g_free (file);
+            return FALSE;
+        }
+        printf ("%-6s %10" G_GSIZE_FORMAT " B  %-6s  read_file %9.1f MB/s  map_file %9.1f MB/s\n",
+                label, size, scanner_names[i], copied, mapped);
+    }
+
+    unlink (file);
+    g_free (file);
+    return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+    GError *error = NULL;
+    gsize huge = (gsize)(argc > 1 ? atoi (argv[1]) : 128) << 20;
+
+    if (!bench_size ("small", 4 << 10, 20000, &error) ||
+        !bench_size ("medium", 1 << 20, 200, &error) ||
+        !bench_size ("huge", huge, 3, &error)) {
+        fprintf (stderr, "lobsterio-bench: %s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+    return 0;
+}
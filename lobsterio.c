@@ -4,17 +4,146 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_SCANNERS 1
+#include <immintrin.h>
+#endif
+
+/* newline scanners: return the first '\n' in [s, end) or NULL */
+typedef const char *(*ScanFunc) (const char *s, const char *end);
+
+static const char *
+scan_scalar (const char *s, const char *end)
+{
+    return memchr (s, '\n', end - s);
+}
+
+#ifdef HAVE_X86_SCANNERS
+__attribute__ ((target ("sse2")))
+static const char *
+scan_sse2 (const char *s, const char *end)
+{
+    const __m128i nl = _mm_set1_epi8 ('\n');
+    int mask;
+
+    for (; end - s >= 16; s += 16) {
+        mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *)s), nl));
+        if (mask) {
+            return s + __builtin_ctz (mask);
+        }
+    }
+    for (; s < end; s++) {
+        if (*s == '\n') {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+__attribute__ ((target ("avx2")))
+static const char *
+scan_avx2 (const char *s, const char *end)
+{
+    const __m256i nl = _mm256_set1_epi8 ('\n');
+    unsigned int mask;
+
+    for (; end - s >= 32; s += 32) {
+        mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)s), nl));
+        if (mask) {
+            return s + __builtin_ctz (mask);
+        }
+    }
+    return scan_sse2 (s, end);
+}
+#endif
+
+static const struct {
+    const char *name;
+    ScanFunc    func;
+} scanners[] = {
+#ifdef HAVE_X86_SCANNERS
+    { "avx2",   scan_avx2 },
+    { "sse2",   scan_sse2 },
+#endif
+    { "scalar", scan_scalar }
+};
+
+static int scanner = -1;
+
+static gboolean
+scanner_supported (int i)
+{
+#ifdef HAVE_X86_SCANNERS
+    __builtin_cpu_init ();
+    if (scanners[i].func == scan_avx2) {
+        return __builtin_cpu_supports ("avx2");
+    }
+    if (scanners[i].func == scan_sse2) {
+        return __builtin_cpu_supports ("sse2");
+    }
+#endif
+    return TRUE;
+}
+
+static ScanFunc
+get_scanner (void)
+{
+    int i = g_atomic_int_get (&scanner);
+    if (G_UNLIKELY (i < 0)) {
+        /* the last entry is always supported */
+        for (i = 0; !scanner_supported (i); i++)
+            ;
+        g_atomic_int_set (&scanner, i);
+    }
+    return scanners[i].func;
+}
+
+gboolean
+lobster_io_set_scanner (const char *name)
+{
+    int i;
+    for (i = 0; i < G_N_ELEMENTS (scanners); i++) {
+        if (!strcmp (scanners[i].name, name)) {
+            if (!scanner_supported (i)) {
+                return FALSE;
+            }
+            g_atomic_int_set (&scanner, i);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *
+lobster_io_get_scanner (void)
+{
+    get_scanner ();
+    return scanners[scanner].name;
+}
 
 static gboolean
 read_by_line (const char *file, LobsterIOReadFileFunc func, gpointer data, GError **error)
 {
+    ScanFunc scan = get_scanner ();
     char *contents;
     char *line_start;
     char *line_end;
+    char *end;
+    gsize length;
     int line_no;
     GError *our_error = NULL;
 
-    if (!g_file_get_contents (file, &contents, NULL, &our_error)) {
+    if (!g_file_get_contents (file, &contents, &length, &our_error)) {
         if (g_error_matches (our_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
             g_error_free (our_error);
             return TRUE;
@@ -23,16 +152,14 @@ read_by_line (const char *file, LobsterIOReadFileFunc func, gpointer data, GErro
         return FALSE;
     }
 
-    for (line_start = line_end = contents, line_no = 1; *line_end; line_end++) {
-        if (*line_end == '\n') {
-            *line_end = '\0';
-            if (!func (file, line_no, line_start, data, error)) {
-                g_free (contents);
-                return FALSE;
-            }
-            ++line_no;
-            line_start = line_end + 1;
+    end = contents + length;
+    for (line_start = contents, line_no = 1; (line_end = (char *)scan (line_start, end)); line_no++) {
+        *line_end = '\0';
+        if (!func (file, line_no, line_start, data, error)) {
+            g_free (contents);
+            return FALSE;
         }
+        line_start = line_end + 1;
     }
     if (!func (file, line_no, line_start, data, error)) {
         g_free (contents);
@@ -49,57 +176,871 @@ lobster_io_read_file (const char *file, LobsterIOReadFileFunc func, gpointer dat
     return read_by_line (file, func, data, error);
 }
 
+static gboolean
+map_by_line (const char *file, const char *contents, gsize length, LobsterIOReadLineFunc func, gpointer data, GError **error)
+{
+    const char *line_start = contents;
+    const char *line_end;
+    const char *end = contents + length;
+    ScanFunc scan = get_scanner ();
+    int line_no;
+
+    for (line_no = 1; (line_end = scan (line_start, end)); line_no++) {
+        if (!func (file, line_no, line_start, line_end - line_start, data, error)) {
+            return FALSE;
+        }
+        line_start = line_end + 1;
+    }
+    return func (file, line_no, line_start, end - line_start, data, error);
+}
+
+static gboolean
+map_unsized (const char *file, LobsterIOReadLineFunc func, gpointer data, GError **error)
+{
+    char *contents;
+    gsize length;
+    gboolean ret;
+    GError *our_error = NULL;
+
+    if (!g_file_get_contents (file, &contents, &length, &our_error)) {
+        if (g_error_matches (our_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_error_free (our_error);
+            return TRUE;
+        }
+        g_propagate_error (error, our_error);
+        return FALSE;
+    }
+
+    ret = map_by_line (file, contents, length, func, data, error);
+    g_free (contents);
+    return ret;
+}
+
+static void
+set_errno_error (GError **error, const char *doing, const char *file, int saved_errno)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not %s %s: %s", doing, file, g_strerror (saved_errno));
+}
+
+/* setting up and tearing down a mapping costs more than copying
+ * a typical ifcfg file */
+#define SMALL_FILE_SIZE (16 << 10)
+
+static gboolean
+read_small (const char *file, int fd, gsize size, LobsterIOReadLineFunc func, gpointer data, GError **error)
+{
+    char buf[SMALL_FILE_SIZE];
+    gsize length = 0;
+    gssize n;
+
+    while (length < size) {
+        n = read (fd, buf + length, size - length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_errno_error (error, "read", file, errno);
+            return FALSE;
+        } else if (n == 0) {
+            break;
+        }
+        length += n;
+    }
+    return map_by_line (file, buf, length, func, data, error);
+}
+
+gboolean
+lobster_io_map_file (const char *file, LobsterIOReadLineFunc func, gpointer data, GError **error)
+{
+    struct stat st;
+    char *contents;
+    gboolean ret;
+    int fd;
+
+    fd = open (file, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return TRUE;
+        }
+        set_errno_error (error, "open", file, errno);
+        return FALSE;
+    }
+
+    if (fstat (fd, &st) < 0) {
+        set_errno_error (error, "stat", file, errno);
+        close (fd);
+        return FALSE;
+    }
+
+    if (!S_ISREG (st.st_mode) || st.st_size == 0) {
+        /* /proc files claim to be empty, and empty files can't be
+         * mapped, so read those the old way */
+        close (fd);
+        return map_unsized (file, func, data, error);
+    }
+
+    if (st.st_size <= SMALL_FILE_SIZE) {
+        ret = read_small (file, fd, st.st_size, func, data, error);
+        close (fd);
+        return ret;
+    }
+
+    contents = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (contents == MAP_FAILED) {
+        set_errno_error (error, "map", file, errno);
+        close (fd);
+        return FALSE;
+    }
+    close (fd);
+
+    madvise (contents, st.st_size, MADV_SEQUENTIAL);
+    ret = map_by_line (file, contents, st.st_size, func, data, error);
+    munmap (contents, st.st_size);
+
+    return ret;
+}
+
+gboolean
+lobster_io_map_files (const char * const *files, gpointer *data, guint n_files, LobsterIOReadLineFunc func, GError **error)
+{
+    guint i;
+
+    for (i = 0; i < n_files; i++) {
+        if (!lobster_io_map_file (files[i], func, data[i], error)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* the overwrite pipeline never holds more than one chunk of input,
+ * one chunk of output and the current line in memory */
+#define CHUNK_SIZE (64 << 10)
+
 typedef struct {
     LobsterIOWriteFileFunc func;
     gpointer               data;
-    GString               *buffer;
+
+    const char            *file;
+    int                    in_fd;    /* the original, or -1 if there isn't one */
+    off_t                  in_size;
+    mode_t                 in_mode;
+    uid_t                  in_uid;
+    gid_t                  in_gid;
+
+    /* output is compared against the original and dropped for as
+     * long as it matches; the temp file only appears at the first
+     * difference */
+    char                  *out;
+    gsize                  out_len;
+    char                  *cmp;
+    off_t                  matched;
+    char                  *temp;
+    int                    temp_fd;
+
     gboolean               last_was_blank;
 } WriteData;
 
 static gboolean
-overwrite_line (const char *file, int line_no, char *line, gpointer data, GError **error)
+write_all (int fd, const char *buf, gsize len, const char *file, GError **error)
+{
+    gssize n;
+    while (len) {
+        n = write (fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_errno_error (error, "write", file, errno);
+            return FALSE;
+        }
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* returns the number of bytes read, which is only short at EOF */
+static gssize
+pread_all (int fd, char *buf, gsize len, off_t offset, const char *file, GError **error)
+{
+    gsize done = 0;
+    gssize n;
+    while (done < len) {
+        n = pread (fd, buf + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_errno_error (error, "read", file, errno);
+            return -1;
+        } else if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static gboolean
+open_temp (WriteData *wd, GError **error)
+{
+    char *dir = g_path_get_dirname (wd->file);
+    char *base = g_path_get_basename (wd->file);
+    off_t offset;
+    gssize n;
+
+    wd->temp = g_strdup_printf ("%s/.%s.lobster-XXXXXX", dir, base);
+    g_free (dir);
+    g_free (base);
+
+    wd->temp_fd = g_mkstemp (wd->temp);
+    if (wd->temp_fd < 0) {
+        set_errno_error (error, "create", wd->temp, errno);
+        g_free (wd->temp);
+        wd->temp = NULL;
+        return FALSE;
+    }
+
+    if (fchmod (wd->temp_fd, wd->in_mode) < 0) {
+        set_errno_error (error, "set permissions on", wd->temp, errno);
+        return FALSE;
+    }
+    if (wd->in_fd >= 0 && fchown (wd->temp_fd, wd->in_uid, wd->in_gid) < 0) {
+        fprintf (stderr, "%s: could not keep owner: %s\n", wd->temp, g_strerror (errno));
+    }
+
+    /* copy the part of the original that matched */
+    for (offset = 0; offset < wd->matched; offset += n) {
+        n = pread_all (wd->in_fd, wd->cmp, MIN (CHUNK_SIZE, wd->matched - offset), offset, wd->file, error);
+        if (n <= 0) {
+            if (n == 0) {
+                g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_IO, "%s changed while it was being rewritten", wd->file);
+            }
+            return FALSE;
+        }
+        if (!write_all (wd->temp_fd, wd->cmp, n, wd->temp, error)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean
+flush_output (WriteData *wd, GError **error)
+{
+    gssize n;
+
+    if (!wd->temp && wd->in_fd >= 0) {
+        n = pread_all (wd->in_fd, wd->cmp, wd->out_len, wd->matched, wd->file, error);
+        if (n < 0) {
+            return FALSE;
+        }
+        if (n == wd->out_len && !memcmp (wd->cmp, wd->out, n)) {
+            wd->matched += n;
+            wd->out_len = 0;
+            return TRUE;
+        }
+    }
+    if (!wd->temp && !open_temp (wd, error)) {
+        return FALSE;
+    }
+    if (!write_all (wd->temp_fd, wd->out, wd->out_len, wd->temp, error)) {
+        return FALSE;
+    }
+    wd->out_len = 0;
+    return TRUE;
+}
+
+static gboolean
+append_output (WriteData *wd, const char *s, gsize len, GError **error)
+{
+    gsize n;
+    while (len) {
+        n = MIN (len, CHUNK_SIZE - wd->out_len);
+        memcpy (wd->out + wd->out_len, s, n);
+        wd->out_len += n;
+        s += n;
+        len -= n;
+        if (wd->out_len == CHUNK_SIZE && !flush_output (wd, error)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean
+overwrite_line (WriteData *wd, int line_no, char *line, GError **error)
 {
-    WriteData *wd = data;
     char *new_line;
+    gboolean blank;
+    gboolean ret = TRUE;
 
-    new_line = wd->func (file, line_no, line, wd->data, error);
+    new_line = wd->func (wd->file, line_no, line, wd->data, error);
     if (!new_line) {
         return FALSE;
     }
-    if (*new_line || !wd->last_was_blank) {
-        g_string_append (wd->buffer, new_line);
-        g_string_append (wd->buffer, "\n");
-        if (new_line != line) {
-            g_free (new_line);
+    blank = !*new_line;
+    /* the last call has nothing to add if it returns nothing */
+    if (!blank || (!wd->last_was_blank && line_no >= 0)) {
+        ret = append_output (wd, new_line, strlen (new_line), error) && append_output (wd, "\n", 1, error);
+    }
+    if (new_line != line) {
+        g_free (new_line);
+    }
+    wd->last_was_blank = blank;
+    return ret;
+}
+
+static gboolean
+overwrite_lines (WriteData *wd, GError **error)
+{
+    ScanFunc scan = get_scanner ();
+    GString *line = g_string_new (NULL);
+    char *in = g_malloc (CHUNK_SIZE);
+    const char *line_start;
+    const char *line_end;
+    const char *end;
+    gboolean ret = FALSE;
+    int line_no = 1;
+    gssize n;
+
+    while (wd->in_fd >= 0) {
+        n = read (wd->in_fd, in, CHUNK_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            set_errno_error (error, "read", wd->file, errno);
+            goto out;
+        } else if (n == 0) {
+            /* whatever follows the last newline is a line too, but
+             * a file that ends in one has no line after it */
+            if (line->len && !overwrite_line (wd, line_no, line->str, error)) {
+                goto out;
+            }
+            break;
+        }
+        end = in + n;
+        for (line_start = in; (line_end = scan (line_start, end)); line_start = line_end + 1) {
+            g_string_append_len (line, line_start, line_end - line_start);
+            if (!overwrite_line (wd, line_no++, line->str, error)) {
+                goto out;
+            }
+            g_string_truncate (line, 0);
         }
+        g_string_append_len (line, line_start, end - line_start);
     }
-    wd->last_was_blank = !*new_line;
-    return TRUE;
+
+    /* one last line to let writers write any extra data that may
+     * not have been included */
+    ret = overwrite_line (wd, -1, NULL, error) && flush_output (wd, error);
+
+out:
+    g_free (in);
+    g_string_free (line, TRUE);
+    return ret;
 }
 
-gboolean
-lobster_io_overwrite_file (const char *file, LobsterIOWriteFileFunc func, gpointer data, GError **error)
+static void
+sync_dir (const char *file)
+{
+    char *dir = g_path_get_dirname (file);
+    int fd = open (dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync (fd);
+        close (fd);
+    }
+    g_free (dir);
+}
+
+/* rename() replaces symlinks rather than what they point at, and
+ * resolv.conf is often a symlink */
+static char *
+resolve_target (const char *file)
+{
+    char *resolved = realpath (file, NULL);
+    char *ret = g_strdup (resolved ? resolved : file);
+    free (resolved);
+    return ret;
+}
+
+/* runs the writer over file and leaves the result in a temp file next
+ * to it, which is neither synced nor renamed yet.  If the contents
+ * did not change, *temp is set to NULL and nothing is written. */
+static gboolean
+stage_file (const char *file, LobsterIOWriteFileFunc func, gpointer data, char **temp, int *temp_fd, GError **error)
 {
-    WriteData wd;
+    WriteData wd = { 0, };
+    struct stat st;
     gboolean ret = FALSE;
 
+    *temp = NULL;
+    *temp_fd = -1;
+
     wd.func = func;
     wd.data = data;
-    wd.buffer = g_string_new (NULL);
-    wd.last_was_blank = FALSE;
+    wd.file = file;
+    wd.temp_fd = -1;
+    wd.in_mode = 0644;
 
-    if (!lobster_io_read_file (file, overwrite_line, &wd, error)) {
-        goto free_buffer;
+    wd.in_fd = open (file, O_RDONLY);
+    if (wd.in_fd < 0) {
+        if (errno != ENOENT) {
+            set_errno_error (error, "open", file, errno);
+            return FALSE;
+        }
+    } else if (fstat (wd.in_fd, &st) < 0) {
+        set_errno_error (error, "stat", file, errno);
+        goto out;
+    } else {
+        wd.in_size = st.st_size;
+        wd.in_mode = st.st_mode & 07777;
+        wd.in_uid = st.st_uid;
+        wd.in_gid = st.st_gid;
     }
 
-    /* one last line to let writers write any extra data that may
-     * not have been included */
-    if (overwrite_line (file, -1, NULL, &wd, error)) {
-        ret = g_file_set_contents (file, wd.buffer->str, -1, error);
-        fprintf (stderr, "NEW CONTENTS OF %s:\n\n%s\n", file, wd.buffer->str);
+    wd.out = g_malloc (CHUNK_SIZE);
+    wd.cmp = g_malloc (CHUNK_SIZE);
+
+    if (!overwrite_lines (&wd, error)) {
+        goto out;
+    }
+
+    if (!wd.temp && wd.in_fd >= 0 && wd.matched == wd.in_size) {
+        fprintf (stderr, "%s: unchanged\n", file);
+        ret = TRUE;
+        goto out;
+    }
+
+    /* the output was a strict prefix of the original (or there was
+     * no original), so nothing has been written yet */
+    if (!wd.temp && !open_temp (&wd, error)) {
+        goto out;
+    }
+
+    *temp = wd.temp;
+    *temp_fd = wd.temp_fd;
+    wd.temp = NULL;
+    wd.temp_fd = -1;
+    ret = TRUE;
+
+out:
+    if (wd.temp_fd >= 0) {
+        close (wd.temp_fd);
+    }
+    if (wd.temp) {
+        unlink (wd.temp);
+        g_free (wd.temp);
+    }
+    if (wd.in_fd >= 0) {
+        close (wd.in_fd);
+    }
+    g_free (wd.out);
+    g_free (wd.cmp);
+    return ret;
+}
+
+gboolean
+lobster_io_overwrite_file (const char *file, LobsterIOWriteFileFunc func, gpointer data, gboolean *changed, GError **error)
+{
+    char *target = resolve_target (file);
+    char *temp;
+    int temp_fd;
+    gboolean ret = FALSE;
+
+    if (!stage_file (target, func, data, &temp, &temp_fd, error)) {
+        goto out;
+    }
+    if (changed) {
+        *changed = temp != NULL;
+    }
+    if (!temp) {
+        ret = TRUE;
+        goto out;
+    }
+
+    if (fsync (temp_fd) < 0) {
+        set_errno_error (error, "sync", temp, errno);
+    } else if (rename (temp, target) < 0) {
+        set_errno_error (error, "replace", target, errno);
+    } else {
+        sync_dir (target);
+        fprintf (stderr, "%s: rewritten\n", target);
+        ret = TRUE;
+    }
+
+    close (temp_fd);
+    if (!ret) {
+        unlink (temp);
+    }
+    g_free (temp);
+
+out:
+    g_free (target);
+    return ret;
+}
+
+/*
+ * Transactions stage every changed file as a temp file, make them all
+ * durable with one barrier, and only then rename them into place.
+ *
+ * While files are being staged, "<journal>.new" lists each temp file
+ * and its target.  At commit, a trailer line is appended and the list
+ * is renamed to "<journal>", which is the commit point.  After a
+ * crash, lobster_io_transaction_recover() finishes the renames listed
+ * in a committed journal, or deletes the temp files listed in an
+ * uncommitted one.
+ */
+
+#define JOURNAL_HEADER "lobster-journal 1\n"
+#define JOURNAL_COMMIT "commit\n"
+
+struct _LobsterIOTransaction {
+    char      *journal;
+    char      *journal_new;
+    int        journal_fd;
+    GPtrArray *temps;
+    GPtrArray *targets;
+    gboolean   committed;
+};
+
+LobsterIOTransaction *
+lobster_io_transaction_new (const char *journal)
+{
+    LobsterIOTransaction *tx = g_new0 (LobsterIOTransaction, 1);
+    tx->journal = g_strdup (journal);
+    tx->journal_new = g_strdup_printf ("%s.new", journal);
+    tx->journal_fd = -1;
+    tx->temps = g_ptr_array_new ();
+    tx->targets = g_ptr_array_new ();
+    return tx;
+}
+
+static gboolean
+journal_append (LobsterIOTransaction *tx, const char *str, GError **error)
+{
+    /* the journal is only created once there is something to commit,
+     * so that saving unchanged files touches nothing at all */
+    if (tx->journal_fd < 0) {
+        tx->journal_fd = open (tx->journal_new, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (tx->journal_fd < 0) {
+            set_errno_error (error, "create", tx->journal_new, errno);
+            return FALSE;
+        }
+        if (!write_all (tx->journal_fd, JOURNAL_HEADER, strlen (JOURNAL_HEADER), tx->journal_new, error)) {
+            return FALSE;
+        }
+    }
+    return write_all (tx->journal_fd, str, strlen (str), tx->journal_new, error);
+}
+
+gboolean
+lobster_io_transaction_overwrite_file (LobsterIOTransaction *tx, const char *file, LobsterIOWriteFileFunc func, gpointer data, gboolean *changed, GError **error)
+{
+    char *target = resolve_target (file);
+    char *temp;
+    char *entry;
+    int temp_fd;
+    gboolean ret;
+
+    g_return_val_if_fail (!tx->committed, FALSE);
+
+    if (!stage_file (target, func, data, &temp, &temp_fd, error)) {
+        g_free (target);
+        return FALSE;
+    }
+    if (changed) {
+        *changed = temp != NULL;
+    }
+    if (!temp) {
+        g_free (target);
+        return TRUE;
+    }
+    close (temp_fd);
+
+    g_ptr_array_add (tx->temps, temp);
+    g_ptr_array_add (tx->targets, target);
+
+    entry = g_strdup_printf ("%s\t%s\n", temp, target);
+    ret = journal_append (tx, entry, error);
+    g_free (entry);
+    return ret;
+}
+
+/* one syncfs() per filesystem where we can, one fdatasync() per
+ * file where we can't */
+static gboolean
+sync_staged (LobsterIOTransaction *tx, GError **error)
+{
+    GArray *devs = g_array_new (FALSE, FALSE, sizeof (dev_t));
+    struct stat st;
+    const char *temp;
+    gboolean ret = FALSE;
+    guint i, j;
+    int fd;
+
+    for (i = 0; i < tx->temps->len; i++) {
+        temp = g_ptr_array_index (tx->temps, i);
+        fd = open (temp, O_RDONLY);
+        if (fd < 0 || fstat (fd, &st) < 0) {
+            set_errno_error (error, "sync", temp, errno);
+            if (fd >= 0) {
+                close (fd);
+            }
+            goto out;
+        }
+#ifdef HAVE_SYNCFS
+        for (j = 0; j < devs->len && g_array_index (devs, dev_t, j) != st.st_dev; j++)
+            ;
+        if (j == devs->len) {
+            g_array_append_val (devs, st.st_dev);
+            if (syncfs (fd) < 0) {
+                set_errno_error (error, "sync", temp, errno);
+                close (fd);
+                goto out;
+            }
+        }
+#else
+        if (fdatasync (fd) < 0) {
+            set_errno_error (error, "sync", temp, errno);
+            close (fd);
+            goto out;
+        }
+#endif
+        close (fd);
+    }
+    ret = TRUE;
+
+out:
+    g_array_free (devs, TRUE);
+    return ret;
+}
+
+static void
+sync_dirs (GPtrArray *files)
+{
+    GHashTable *dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    char *dir;
+    guint i;
+
+    for (i = 0; i < files->len; i++) {
+        dir = g_path_get_dirname (g_ptr_array_index (files, i));
+        if (g_hash_table_lookup (dirs, dir)) {
+            g_free (dir);
+            continue;
+        }
+        g_hash_table_insert (dirs, dir, dir);
+        sync_dir (g_ptr_array_index (files, i));
+    }
+    g_hash_table_destroy (dirs);
+}
+
+gboolean
+lobster_io_transaction_commit (LobsterIOTransaction *tx, GError **error)
+{
+    guint i;
+
+    g_return_val_if_fail (!tx->committed, FALSE);
+
+    if (!tx->temps->len) {
+        fprintf (stderr, "transaction: nothing to commit\n");
+        tx->committed = TRUE;
+        return TRUE;
+    }
+
+    if (!sync_staged (tx, error) ||
+        !journal_append (tx, JOURNAL_COMMIT, error)) {
+        return FALSE;
+    }
+    if (fdatasync (tx->journal_fd) < 0) {
+        set_errno_error (error, "sync", tx->journal_new, errno);
+        return FALSE;
+    }
+    close (tx->journal_fd);
+    tx->journal_fd = -1;
+
+    if (rename (tx->journal_new, tx->journal) < 0) {
+        set_errno_error (error, "commit", tx->journal, errno);
+        return FALSE;
+    }
+    sync_dir (tx->journal);
+
+    /* from here on recovery rolls forward, so the temp files must be
+     * left in place even if a rename fails */
+    tx->committed = TRUE;
+
+    for (i = 0; i < tx->temps->len; i++) {
+        if (rename (g_ptr_array_index (tx->temps, i), g_ptr_array_index (tx->targets, i)) < 0) {
+            set_errno_error (error, "replace", g_ptr_array_index (tx->targets, i), errno);
+            return FALSE;
+        }
+        fprintf (stderr, "%s: rewritten\n", (char *)g_ptr_array_index (tx->targets, i));
+    }
+    sync_dirs (tx->targets);
+
+    unlink (tx->journal);
+    return TRUE;
+}
+
+void
+lobster_io_transaction_free (LobsterIOTransaction *tx)
+{
+    guint i;
+
+    if (tx->journal_fd >= 0) {
+        close (tx->journal_fd);
+    }
+    if (!tx->committed) {
+        for (i = 0; i < tx->temps->len; i++) {
+            unlink (g_ptr_array_index (tx->temps, i));
+        }
+        unlink (tx->journal_new);
+    }
+
+    g_ptr_array_foreach (tx->temps, (GFunc)g_free, NULL);
+    g_ptr_array_free (tx->temps, TRUE);
+    g_ptr_array_foreach (tx->targets, (GFunc)g_free, NULL);
+    g_ptr_array_free (tx->targets, TRUE);
+    g_free (tx->journal);
+    g_free (tx->journal_new);
+    g_free (tx);
+}
+
+/* adds the temp and target of every entry to entries, in pairs;
+ * returns whether the journal is whole and ends in the commit trailer,
+ * which a torn one can't */
+static gboolean
+journal_parse (char *contents, gsize len, GPtrArray *entries)
+{
+    char **lines;
+    gboolean whole, committed = FALSE;
+    char *tab;
+    gsize i;
+
+    /* a torn file can have a block of zeroes anywhere */
+    for (i = 0; i < len; i++) {
+        if (!contents[i]) {
+            contents[i] = '\n';
+        }
+    }
+    lines = g_strsplit (contents, "\n", -1);
+    whole = !strcmp (lines[0], "lobster-journal 1");
+
+    for (i = 1; lines[i]; i++) {
+        if (!*lines[i]) {
+            /* only the newline ending the file may be followed by
+             * nothing */
+            whole = whole && !lines[i + 1];
+        } else if (committed) {
+            whole = FALSE;
+        } else if (!strcmp (lines[i], "commit")) {
+            committed = TRUE;
+        } else if ((tab = strchr (lines[i], '\t'))) {
+            g_ptr_array_add (entries, g_strndup (lines[i], tab - lines[i]));
+            g_ptr_array_add (entries, g_strdup (tab + 1));
+        } else {
+            whole = FALSE;
+        }
+    }
+    whole = whole && i > 1 && !*lines[i - 1];
+    g_strfreev (lines);
+    return whole && committed;
+}
+
+/* whether temp is named as stage_file() names temps for target, so
+ * that a damaged journal can't have anything else deleted */
+static gboolean
+is_temp_for (const char *temp, const char *target)
+{
+    char *dir = g_path_get_dirname (target);
+    char *base = g_path_get_basename (target);
+    char *prefix = g_strdup_printf ("%s/.%s.lobster-", dir, base);
+    gboolean ret = g_str_has_prefix (temp, prefix) && strlen (temp) == strlen (prefix) + 6;
+
+    g_free (dir);
+    g_free (base);
+    g_free (prefix);
+    return ret;
+}
+
+static void
+roll_forward (const char *temp, const char *target)
+{
+    if (g_file_test (temp, G_FILE_TEST_EXISTS)) {
+        fprintf (stderr, "recovering %s\n", target);
+        if (rename (temp, target) < 0) {
+            fprintf (stderr, "%s: %s\n", target, g_strerror (errno));
+        }
+        sync_dir (target);
+    }
+}
+
+static void
+roll_back (const char *temp, const char *target)
+{
+    if (is_temp_for (temp, target)) {
+        fprintf (stderr, "discarding %s\n", temp);
+        unlink (temp);
+    }
+}
+
+static void
+journal_foreach (GPtrArray *entries, void (*func) (const char *temp, const char *target))
+{
+    guint i;
+
+    for (i = 0; i + 1 < entries->len; i += 2) {
+        func (g_ptr_array_index (entries, i), g_ptr_array_index (entries, i + 1));
+    }
+}
+
+gboolean
+lobster_io_transaction_recover (const char *journal, GError **error)
+{
+    char *journal_new = g_strdup_printf ("%s.new", journal);
+    GPtrArray *entries = g_ptr_array_new_with_free_func (g_free);
+    char *contents;
+    gsize len;
+    gboolean ret = FALSE;
+    GError *our_error = NULL;
+
+    /* nothing is renamed unless the whole journal is there */
+    if (g_file_get_contents (journal, &contents, &len, &our_error)) {
+        if (!journal_parse (contents, len, entries)) {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s is damaged; remove it to continue", journal);
+            g_free (contents);
+            goto out;
+        }
+        g_free (contents);
+        journal_foreach (entries, roll_forward);
+        g_ptr_array_set_size (entries, 0);
+        unlink (journal);
+    } else if (!g_error_matches (our_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_error (error, our_error);
+        goto out;
+    } else {
+        g_clear_error (&our_error);
+    }
+
+    /* never committed, even if it got as far as the trailer, and
+     * maybe torn anywhere, header included */
+    if (g_file_get_contents (journal_new, &contents, &len, &our_error)) {
+        journal_parse (contents, len, entries);
+        journal_foreach (entries, roll_back);
+        g_free (contents);
+        unlink (journal_new);
+    } else if (!g_error_matches (our_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_error (error, our_error);
+        goto out;
+    } else {
+        g_clear_error (&our_error);
     }
+    ret = TRUE;
 
-free_buffer:
-    g_string_free (wd.buffer, TRUE);
+out:
+    g_ptr_array_free (entries, TRUE);
+    g_free (journal_new);
     return ret;
 }
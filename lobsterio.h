@@ -9,12 +9,38 @@ G_BEGIN_DECLS
 typedef gboolean  (*LobsterIOReadFileFunc)  (const char *file, int line_no, char *line, gpointer data, GError **error);
 typedef char     *(*LobsterIOWriteFileFunc) (const char *file, int line_no, char *line, gpointer data, GError **error);
 
+/* line is not NUL-terminated and points into a read-only mapping of
+ * the file; it is only valid for the duration of the callback. */
+typedef gboolean  (*LobsterIOReadLineFunc)  (const char *file, int line_no, const char *line, gsize len, gpointer data, GError **error);
+
+typedef struct _LobsterIOTransaction LobsterIOTransaction;
+
 G_END_DECLS
 
 G_BEGIN_DECLS
 
 gboolean lobster_io_read_file      (const char *file, LobsterIOReadFileFunc func, gpointer data, GError **error);
-gboolean lobster_io_overwrite_file (const char *file, LobsterIOWriteFileFunc func, gpointer data, GError **error);
+/* the file is only rewritten if the writer changed its contents;
+ * changed, if not NULL, says whether it was */
+gboolean lobster_io_overwrite_file (const char *file, LobsterIOWriteFileFunc func, gpointer data, gboolean *changed, GError **error);
+
+gboolean lobster_io_map_file       (const char *file, LobsterIOReadLineFunc func, gpointer data, GError **error);
+/* lobster_io_map_file() on each file in turn, passing data[i] for
+ * files[i]; stops at the first error */
+gboolean lobster_io_map_files      (const char * const *files, gpointer *data, guint n_files, LobsterIOReadLineFunc func, GError **error);
+
+/* stage any number of files and replace them all at once; see
+ * lobsterio.c for the journal format */
+LobsterIOTransaction *lobster_io_transaction_new (const char *journal);
+gboolean lobster_io_transaction_overwrite_file (LobsterIOTransaction *tx, const char *file, LobsterIOWriteFileFunc func, gpointer data, gboolean *changed, GError **error);
+gboolean lobster_io_transaction_commit (LobsterIOTransaction *tx, GError **error);
+void     lobster_io_transaction_free (LobsterIOTransaction *tx);
+gboolean lobster_io_transaction_recover (const char *journal, GError **error);
+
+/* the newline scanner ("avx2", "sse2" or "scalar") is picked for the
+ * running CPU on first use; these are for benchmarking */
+gboolean    lobster_io_set_scanner (const char *name);
+const char *lobster_io_get_scanner (void);
 
 G_END_DECLS
 
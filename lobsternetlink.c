@@ -0,0 +1,354 @@
+#include "config.h"
+
+#include "lobsternetlink.h"
+
+#include <glib.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+#define PROMOTE_SECONDARIES "/proc/sys/net/ipv4/conf/%s/promote_secondaries"
+/* sends happen on the main loop, so a lost answer must not hang it */
+#define REPLY_TIMEOUT 2         /* seconds */
+
+/*
+ * Requests carry no NLM_F_ACK, so the kernel only answers the ones
+ * that fail, and a NOOP that does ask for one closes the batch: once
+ * its answer is in, everything before it has been done.  That keeps
+ * the replies small however big the batch is.
+ */
+
+struct _LobsterNetlinkBatch {
+    GByteArray *buf;
+    GPtrArray  *what;           /* a description per request, by seq - 1 */
+    GPtrArray  *promote;        /* devices losing an IPv4 address */
+};
+
+LobsterNetlinkBatch *
+lobster_netlink_batch_new (void)
+{
+    LobsterNetlinkBatch *batch = g_new0 (LobsterNetlinkBatch, 1);
+    batch->buf = g_byte_array_new ();
+    batch->what = g_ptr_array_new_with_free_func (g_free);
+    batch->promote = g_ptr_array_new_with_free_func (g_free);
+    return batch;
+}
+
+void
+lobster_netlink_batch_free (LobsterNetlinkBatch *batch)
+{
+    if (batch) {
+        g_byte_array_free (batch->buf, TRUE);
+        g_ptr_array_free (batch->what, TRUE);
+        g_ptr_array_free (batch->promote, TRUE);
+        g_free (batch);
+    }
+}
+
+guint
+lobster_netlink_batch_size (const LobsterNetlinkBatch *batch)
+{
+    return batch->what->len;
+}
+
+static gboolean
+device_index (const char *device, int *index, GError **error)
+{
+    *index = if_nametoindex (device);
+    if (!*index) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "%s: %s", device, g_strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static guint
+address_len (const LobsterAddress *addr)
+{
+    return addr->family == AF_INET6 ? 16 : 4;
+}
+
+/* starts a request with a header of hdr_len bytes, which is returned */
+static gpointer
+message_start (LobsterNetlinkBatch *batch, guint16 type, guint16 flags, gsize hdr_len, char *what)
+{
+    gsize offset = batch->buf->len;
+    struct nlmsghdr *nlh;
+
+    g_byte_array_set_size (batch->buf, offset + NLMSG_SPACE (hdr_len));
+    nlh = (struct nlmsghdr *)(batch->buf->data + offset);
+    memset (nlh, 0, NLMSG_SPACE (hdr_len));
+    nlh->nlmsg_len = NLMSG_LENGTH (hdr_len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    g_ptr_array_add (batch->what, what);
+    nlh->nlmsg_seq = batch->what->len;
+    return NLMSG_DATA (nlh);
+}
+
+static void
+message_add_attr (LobsterNetlinkBatch *batch, gsize start, guint16 type, gconstpointer data, gsize len)
+{
+    struct nlmsghdr *nlh;
+    struct rtattr *rta;
+    gsize offset = batch->buf->len;
+
+    g_byte_array_set_size (batch->buf, offset + RTA_SPACE (len));
+    rta = (struct rtattr *)(batch->buf->data + offset);
+    memset (rta, 0, RTA_SPACE (len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH (len);
+    memcpy (RTA_DATA (rta), data, len);
+
+    nlh = (struct nlmsghdr *)(batch->buf->data + start);
+    nlh->nlmsg_len = NLMSG_ALIGN (nlh->nlmsg_len) + RTA_SPACE (len);
+}
+
+static void
+address_message (LobsterNetlinkBatch *batch, guint16 type, guint16 flags, int index,
+                 const LobsterAddress *addr, char *what)
+{
+    gsize start = batch->buf->len;
+    struct ifaddrmsg *ifa = message_start (batch, type, flags, sizeof (*ifa), what);
+    guint8 broadcast[4];
+    guint i;
+
+    ifa->ifa_family = addr->family;
+    ifa->ifa_prefixlen = addr->prefix;
+    ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa->ifa_index = index;
+
+    message_add_attr (batch, start, IFA_LOCAL, addr->bytes, address_len (addr));
+    message_add_attr (batch, start, IFA_ADDRESS, addr->bytes, address_len (addr));
+    /* as ifup sets it */
+    if (addr->family == AF_INET && addr->prefix < 31) {
+        for (i = 0; i < 4; i++) {
+            guint bits = MIN (8, addr->prefix - MIN (addr->prefix, 8 * i));
+            broadcast[i] = addr->bytes[i] | (guint8)~(0xff00 >> bits);
+        }
+        message_add_attr (batch, start, IFA_BROADCAST, broadcast, 4);
+    }
+}
+
+static char *
+describe (const char *verb, const LobsterAddress *addr, const char *device)
+{
+    char *text = lobster_address_to_string (addr, TRUE);
+    char *what = g_strdup_printf ("%s %s%s%s", verb, text, device ? " dev " : "", device ? device : "");
+    g_free (text);
+    return what;
+}
+
+gboolean
+lobster_netlink_add_address (LobsterNetlinkBatch *batch, const char *device, const LobsterAddress *addr, GError **error)
+{
+    int index;
+
+    if (!device_index (device, &index, error)) {
+        return FALSE;
+    }
+    /* replacing lets an address that is already there count as added */
+    address_message (batch, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, index, addr,
+                     describe ("adding", addr, device));
+    return TRUE;
+}
+
+gboolean
+lobster_netlink_delete_address (LobsterNetlinkBatch *batch, const char *device, const LobsterAddress *addr, GError **error)
+{
+    int index;
+
+    if (!device_index (device, &index, error)) {
+        return FALSE;
+    }
+    address_message (batch, RTM_DELADDR, 0, index, addr, describe ("deleting", addr, device));
+    /* or an address added in the same subnet, which is secondary to
+     * this one, would go with it */
+    if (addr->family == AF_INET) {
+        g_ptr_array_add (batch->promote, g_strdup (device));
+    }
+    return TRUE;
+}
+
+gboolean
+lobster_netlink_replace_route (LobsterNetlinkBatch *batch, const LobsterAddress *destination,
+                               const LobsterAddress *gateway, const char *device, GError **error)
+{
+    gsize start = batch->buf->len;
+    struct rtmsg *rtm;
+    char *via = lobster_address_to_string (gateway, FALSE);
+    char *what;
+    int index = 0;
+
+    if (device && !device_index (device, &index, error)) {
+        g_free (via);
+        return FALSE;
+    }
+    what = describe ("routing", destination, device);
+    if (*via) {
+        char *with_via = g_strdup_printf ("%s via %s", what, via);
+        g_free (what);
+        what = with_via;
+    }
+    g_free (via);
+
+    rtm = message_start (batch, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, sizeof (*rtm), what);
+    rtm->rtm_family = destination->family;
+    rtm->rtm_dst_len = destination->prefix;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_BOOT;
+    rtm->rtm_scope = gateway->family != AF_UNSPEC ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+    rtm->rtm_type = RTN_UNICAST;
+
+    if (destination->prefix) {
+        message_add_attr (batch, start, RTA_DST, destination->bytes, address_len (destination));
+    }
+    if (gateway->family != AF_UNSPEC) {
+        message_add_attr (batch, start, RTA_GATEWAY, gateway->bytes, address_len (gateway));
+    }
+    if (index) {
+        message_add_attr (batch, start, RTA_OIF, &index, sizeof (index));
+    }
+    return TRUE;
+}
+
+/* sets device's promote_secondaries and returns what it was, or NULL
+ * if it couldn't be read or set */
+static char *
+promote_secondaries (const char *device, const char *value)
+{
+    char *file = g_strdup_printf (PROMOTE_SECONDARIES, device);
+    char *old = NULL;
+    FILE *f;
+    gboolean ok = g_file_get_contents (file, &old, NULL, NULL);
+
+    /* /proc files can't be replaced, only written */
+    if (ok && (f = fopen (file, "w"))) {
+        ok = fputs (value, f) >= 0;
+        ok = fclose (f) == 0 && ok;
+    } else {
+        ok = FALSE;
+    }
+    if (!ok) {
+        fprintf (stderr, "%s: %s\n", file, g_strerror (errno));
+        g_free (old);
+        old = NULL;
+    }
+    g_free (file);
+    return old;
+}
+
+gboolean
+lobster_netlink_batch_send (LobsterNetlinkBatch *batch, GError **error)
+{
+    struct sockaddr_nl kernel = { AF_NETLINK };
+    struct iovec iov;
+    struct msghdr msg = { 0 };
+    struct timeval timeout = { REPLY_TIMEOUT, 0 };
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    guint8 reply[16384];
+    guint32 last;
+    int fd, one = 1, size;
+    ssize_t len;
+    gboolean done = FALSE, failed = FALSE;
+    GPtrArray *was;
+    guint i;
+
+    if (!batch->what->len) {
+        return TRUE;
+    }
+    /* only for as long as the batch takes */
+    was = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < batch->promote->len; i++) {
+        g_ptr_array_add (was, promote_secondaries (g_ptr_array_index (batch->promote, i), "1\n"));
+    }
+
+    message_start (batch, NLMSG_NOOP, NLM_F_ACK, 0, g_strdup ("finishing"));
+    last = batch->what->len;
+
+    fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        goto error;
+    }
+    /* the whole batch has to fit in one send */
+    size = batch->buf->len;
+    setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+    setsockopt (fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof (one));
+    if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) < 0) {
+        goto error;
+    }
+
+    iov.iov_base = batch->buf->data;
+    iov.iov_len = batch->buf->len;
+    msg.msg_name = &kernel;
+    msg.msg_namelen = sizeof (kernel);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (sendmsg (fd, &msg, 0) < 0) {
+        goto error;
+    }
+
+    while (!done) {
+        len = recv (fd, reply, sizeof (reply), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = ETIMEDOUT;
+            }
+            goto error;
+        }
+        for (nlh = (struct nlmsghdr *)reply; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_seq == 0 || nlh->nlmsg_seq > batch->what->len) {
+                continue;
+            }
+            err = NLMSG_DATA (nlh);
+            if (err->error) {
+                const char *what = g_ptr_array_index (batch->what, nlh->nlmsg_seq - 1);
+                fprintf (stderr, "netlink: %s: %s\n", what, g_strerror (-err->error));
+                if (!failed) {
+                    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (-err->error),
+                                 "%s: %s", what, g_strerror (-err->error));
+                }
+                failed = TRUE;
+            }
+            done |= nlh->nlmsg_seq == last;
+        }
+    }
+    goto out;
+
+error:
+    /* a request may have failed before the answers stopped */
+    if (!failed) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "netlink: %s", g_strerror (errno));
+    }
+    failed = TRUE;
+
+out:
+    if (fd >= 0) {
+        close (fd);
+    }
+    /* backwards, so a device listed twice ends up as it was */
+    for (i = was->len; i-- > 0;) {
+        if (g_ptr_array_index (was, i)) {
+            g_free (promote_secondaries (g_ptr_array_index (batch->promote, i), g_ptr_array_index (was, i)));
+        }
+    }
+    g_ptr_array_free (was, TRUE);
+    return !failed;
+}
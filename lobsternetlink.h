@@ -0,0 +1,41 @@
+#ifndef LOBSTER_NETLINK_H
+#define LOBSTER_NETLINK_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+#include <glib/gerror.h>
+
+#include "lobsteraddr.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterNetlinkBatch LobsterNetlinkBatch;
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* rtnetlink requests that are built up and then go to the kernel in
+ * one sendmsg(), which carries them out in the order they were added */
+LobsterNetlinkBatch *lobster_netlink_batch_new  (void);
+void                 lobster_netlink_batch_free (LobsterNetlinkBatch *batch);
+guint                lobster_netlink_batch_size (const LobsterNetlinkBatch *batch);
+
+/* these fail only if there is no such device */
+gboolean lobster_netlink_add_address    (LobsterNetlinkBatch *batch, const char *device,
+                                         const LobsterAddress *addr, GError **error);
+gboolean lobster_netlink_delete_address (LobsterNetlinkBatch *batch, const char *device,
+                                         const LobsterAddress *addr, GError **error);
+/* replaces the main table's route to destination, whatever it was; a
+ * gateway without a family or a NULL device is left out */
+gboolean lobster_netlink_replace_route  (LobsterNetlinkBatch *batch, const LobsterAddress *destination,
+                                         const LobsterAddress *gateway, const char *device, GError **error);
+
+/* sends the batch and waits for the kernel to finish it, though not
+ * for more than a couple of seconds; the error names the first request
+ * that failed, though the rest still ran */
+gboolean lobster_netlink_batch_send     (LobsterNetlinkBatch *batch, GError **error);
+
+G_END_DECLS
+
+#endif /* LOBSTER_NETLINK_H */
@@ -0,0 +1,439 @@
+#include "config.h"
+
+#include "lobsterresolv.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* what the resolver caps them at */
+#define MAX_TIMEOUT     30
+#define MAX_ATTEMPTS    5
+
+#define SEPARATORS      " \t\r,"
+
+/* the next token in [*p, end), or FALSE at the end */
+static gboolean
+next_token (const char **p, const char *end, const char **token, gsize *len)
+{
+    const char *s = *p;
+    while (s < end && strchr (SEPARATORS, *s)) {
+        s++;
+    }
+    if (s == end) {
+        *p = s;
+        return FALSE;
+    }
+    *token = s;
+    while (s < end && !strchr (SEPARATORS, *s)) {
+        s++;
+    }
+    *len = s - *token;
+    *p = s;
+    return TRUE;
+}
+
+static gboolean
+token_is (const char *token, gsize len, const char *word)
+{
+    return strlen (word) == len && !memcmp (token, word, len);
+}
+
+/* "name:N" with N in [0, max]; -1 if token isn't name:, -2 if N is bad */
+static int
+option_value (const char *token, gsize len, const char *name, int max)
+{
+    gsize name_len = strlen (name);
+    gint64 val = 0;
+    gsize i;
+
+    if (len <= name_len || memcmp (token, name, name_len) || token[name_len] != ':') {
+        return -1;
+    }
+    for (i = name_len + 1; i < len; i++) {
+        if (!g_ascii_isdigit (token[i]) || (val = val * 10 + (token[i] - '0')) > max) {
+            return -2;
+        }
+    }
+    return i > name_len + 1 ? (int)val : -2;
+}
+
+/* servers and texts are parallel, as in a resolver */
+typedef struct {
+    GArray    *servers;
+    GPtrArray *texts;
+} ServerList;
+
+static gboolean
+known_server (const LobsterResolver *known, const char *token, gsize len)
+{
+    guint i;
+
+    for (i = 0; known && known->server_text && i < known->n_servers; i++) {
+        if (known->server_text[i] && token_is (token, len, known->server_text[i])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* an address, a scoped IPv6 address, or with keep anything at all,
+ * which is kept as written */
+static gboolean
+parse_server (ServerList *list, const char *token, gsize len, gboolean keep, LobsterArena *arena)
+{
+    LobsterAddress addr;
+    const char *scope = memchr (token, '%', len);
+    gboolean had_prefix;
+    char *text = NULL;
+
+    lobster_address_clear (&addr);
+    if (lobster_address_parse (&addr, token, len, &had_prefix) && !had_prefix) {
+        ;
+    } else if (scope && scope + 1 < token + len &&
+               lobster_address_parse (&addr, token, scope - token, &had_prefix) && !had_prefix &&
+               addr.family == AF_INET6) {
+        text = lobster_arena_strndup (arena, token, len);
+    } else if (keep) {
+        lobster_address_clear (&addr);
+        text = lobster_arena_strndup (arena, token, len);
+    } else {
+        return FALSE;
+    }
+    g_array_append_val (list->servers, addr);
+    g_ptr_array_add (list->texts, text);
+    return TRUE;
+}
+
+/* the keyword a resolv.conf line starts with, and where its arguments
+ * start; 0 for other lines */
+static guint
+line_field (const char *line, gsize len, const char **args)
+{
+    const char *p = line, *end = line + len, *word;
+    gsize word_len;
+
+    if (!next_token (&p, end, &word, &word_len)) {
+        return 0;
+    }
+    *args = p;
+    if (token_is (word, word_len, "nameserver")) {
+        return LOBSTER_RESOLVER_SERVERS;
+    }
+    /* domain is a search list of one, and the last of them wins */
+    if (token_is (word, word_len, "search") || token_is (word, word_len, "domain")) {
+        return LOBSTER_RESOLVER_SEARCH;
+    }
+    if (token_is (word, word_len, "options")) {
+        return LOBSTER_RESOLVER_OPTIONS;
+    }
+    return 0;
+}
+
+static void
+parse_line (LobsterResolver *res, ServerList *servers, GPtrArray *search, const char *line, gsize len,
+            gboolean bare_servers, const LobsterResolver *known, LobsterArena *arena)
+{
+    const char *end = line + len, *p, *token;
+    gsize token_len;
+    int val;
+
+    p = line;
+    if (!next_token (&p, end, &token, &token_len) || *token == '#' || *token == ';') {
+        return;
+    }
+
+    switch (line_field (line, len, &p)) {
+    case LOBSTER_RESOLVER_SERVERS:
+        if (next_token (&p, end, &token, &token_len)) {
+            res->invalid |= !parse_server (servers, token, token_len,
+                                           !bare_servers || known_server (known, token, token_len), arena);
+        } else {
+            res->invalid |= bare_servers;
+        }
+        break;
+    case LOBSTER_RESOLVER_SEARCH:
+        g_ptr_array_set_size (search, 0);
+        while (next_token (&p, end, &token, &token_len)) {
+            g_ptr_array_add (search, lobster_arena_strndup (arena, token, token_len));
+        }
+        break;
+    case LOBSTER_RESOLVER_OPTIONS:
+        while (next_token (&p, end, &token, &token_len)) {
+            if (token_is (token, token_len, "rotate")) {
+                res->rotate = TRUE;
+            } else if ((val = option_value (token, token_len, "timeout", MAX_TIMEOUT)) != -1) {
+                res->timeout = val >= 0 ? val : res->timeout;
+                res->invalid |= val < 0 && bare_servers;
+            } else if ((val = option_value (token, token_len, "attempts", MAX_ATTEMPTS)) != -1) {
+                res->attempts = val >= 0 ? val : res->attempts;
+                res->invalid |= val < 0 && bare_servers;
+            } else if (bare_servers) {
+                /* the file keeps options we don't know, but they
+                 * can't be typed */
+                res->invalid = TRUE;
+            }
+        }
+        break;
+    default:
+        if (bare_servers) {
+            for (p = line; next_token (&p, end, &token, &token_len); ) {
+                if (!parse_server (servers, token, token_len, known_server (known, token, token_len), arena)) {
+                    res->invalid = TRUE;
+                }
+            }
+        }
+        break;
+    }
+}
+
+LobsterResolver *
+lobster_resolver_parse (const char *text, gsize len, gboolean bare_servers, const LobsterResolver *known,
+                        LobsterArena *arena)
+{
+    LobsterResolver *res = lobster_arena_new0 (arena, LobsterResolver);
+    ServerList servers = { g_array_new (FALSE, FALSE, sizeof (LobsterAddress)), g_ptr_array_new () };
+    GPtrArray *search = g_ptr_array_new ();
+    const char *end = text + len, *eol;
+    guint i;
+
+    res->timeout = res->attempts = LOBSTER_RESOLVER_UNSET;
+    for (; text < end; text = eol + 1) {
+        eol = memchr (text, '\n', end - text);
+        if (!eol) {
+            eol = end;
+        }
+        parse_line (res, &servers, search, text, eol - text, bare_servers, known, arena);
+    }
+
+    res->n_servers = servers.servers->len;
+    res->servers = lobster_arena_alloc0 (arena, res->n_servers * sizeof (LobsterAddress));
+    memcpy (res->servers, servers.servers->data, res->n_servers * sizeof (LobsterAddress));
+    for (i = 0; i < res->n_servers; i++) {
+        if (g_ptr_array_index (servers.texts, i)) {
+            res->server_text = lobster_arena_alloc0 (arena, res->n_servers * sizeof (char *));
+            memcpy (res->server_text, servers.texts->pdata, res->n_servers * sizeof (char *));
+            break;
+        }
+    }
+    res->n_search = search->len;
+    res->search = lobster_arena_alloc0 (arena, search->len * sizeof (char *));
+    memcpy (res->search, search->pdata, search->len * sizeof (char *));
+
+    g_array_free (servers.servers, TRUE);
+    g_ptr_array_free (servers.texts, TRUE);
+    g_ptr_array_free (search, TRUE);
+    return res;
+}
+
+static gboolean
+has_options (const LobsterResolver *res)
+{
+    return res->timeout != LOBSTER_RESOLVER_UNSET || res->attempts != LOBSTER_RESOLVER_UNSET || res->rotate;
+}
+
+static void
+append_options (GString *buf, const LobsterResolver *res)
+{
+    if (res->timeout != LOBSTER_RESOLVER_UNSET) {
+        g_string_append_printf (buf, " timeout:%d", res->timeout);
+    }
+    if (res->attempts != LOBSTER_RESOLVER_UNSET) {
+        g_string_append_printf (buf, " attempts:%d", res->attempts);
+    }
+    if (res->rotate) {
+        g_string_append (buf, " rotate");
+    }
+}
+
+static void
+append_search (GString *buf, const LobsterResolver *res)
+{
+    guint i;
+    g_string_append (buf, "search");
+    for (i = 0; i < res->n_search; i++) {
+        g_string_append_c (buf, ' ');
+        g_string_append (buf, res->search[i]);
+    }
+}
+
+/* as written if we have that, else the address */
+static char *
+server_to_string (const LobsterResolver *res, guint i)
+{
+    if (res->server_text && res->server_text[i]) {
+        return g_strdup (res->server_text[i]);
+    }
+    return lobster_address_to_string (&res->servers[i], FALSE);
+}
+
+static const char *
+server_text (const LobsterResolver *res, guint i)
+{
+    return res->server_text ? res->server_text[i] : NULL;
+}
+
+/* the lines for a field, separated but not ended by newlines */
+static void
+append_field (GString *buf, const LobsterResolver *res, guint field)
+{
+    char *addr;
+    guint i;
+
+    switch (field) {
+    case LOBSTER_RESOLVER_SERVERS:
+        for (i = 0; i < res->n_servers; i++) {
+            addr = server_to_string (res, i);
+            g_string_append_printf (buf, "%snameserver %s", i ? "\n" : "", addr);
+            g_free (addr);
+        }
+        break;
+    case LOBSTER_RESOLVER_SEARCH:
+        if (res->n_search) {
+            append_search (buf, res);
+        }
+        break;
+    case LOBSTER_RESOLVER_OPTIONS:
+        if (has_options (res)) {
+            g_string_append (buf, "options");
+            append_options (buf, res);
+        }
+        break;
+    }
+}
+
+char *
+lobster_resolver_to_string (const LobsterResolver *res)
+{
+    GString *buf = g_string_new (NULL);
+    char *addr;
+    guint i;
+
+    for (i = 0; i < res->n_servers; i++) {
+        addr = server_to_string (res, i);
+        g_string_append_printf (buf, "%s\n", addr);
+        g_free (addr);
+    }
+    if (res->n_search) {
+        append_search (buf, res);
+        g_string_append_c (buf, '\n');
+    }
+    if (has_options (res)) {
+        g_string_append (buf, "options");
+        append_options (buf, res);
+        g_string_append_c (buf, '\n');
+    }
+    return g_string_free (buf, FALSE);
+}
+
+guint
+lobster_resolver_diff (const LobsterResolver *a, const LobsterResolver *b)
+{
+    guint dirty = 0;
+    guint i;
+
+    if (a->n_servers != b->n_servers) {
+        dirty |= LOBSTER_RESOLVER_SERVERS;
+    }
+    for (i = 0; !dirty && i < a->n_servers; i++) {
+        if (!lobster_address_equal (&a->servers[i], &b->servers[i]) ||
+            g_strcmp0 (server_text (a, i), server_text (b, i))) {
+            dirty |= LOBSTER_RESOLVER_SERVERS;
+        }
+    }
+
+    if (a->n_search != b->n_search) {
+        dirty |= LOBSTER_RESOLVER_SEARCH;
+    }
+    for (i = 0; !(dirty & LOBSTER_RESOLVER_SEARCH) && i < a->n_search; i++) {
+        if (strcmp (a->search[i], b->search[i])) {
+            dirty |= LOBSTER_RESOLVER_SEARCH;
+        }
+    }
+
+    if (a->timeout != b->timeout || a->attempts != b->attempts || !a->rotate != !b->rotate) {
+        dirty |= LOBSTER_RESOLVER_OPTIONS;
+    }
+    return dirty;
+}
+
+/* other options on the line are kept, in order; ours go on the first
+ * options line */
+static char *
+rewrite_options (LobsterResolverWriter *writer, const char *args, const char *end)
+{
+    GString *buf = g_string_new ("options");
+    const char *token;
+    gsize len;
+
+    while (next_token (&args, end, &token, &len)) {
+        if (token_is (token, len, "rotate") ||
+            option_value (token, len, "timeout", G_MAXINT) != -1 ||
+            option_value (token, len, "attempts", G_MAXINT) != -1) {
+            continue;
+        }
+        g_string_append_c (buf, ' ');
+        g_string_append_len (buf, token, len);
+    }
+    if (!(writer->written & LOBSTER_RESOLVER_OPTIONS)) {
+        append_options (buf, writer->resolver);
+        writer->written |= LOBSTER_RESOLVER_OPTIONS;
+    }
+    if (buf->len == strlen ("options")) {
+        g_string_truncate (buf, 0);
+    }
+    return g_string_free (buf, FALSE);
+}
+
+/* the first line of a field is replaced by all of it, and the rest
+ * are dropped; a field with no lines is appended */
+char *
+lobster_resolver_write_func (const char *file, int line_no, char *line, gpointer data, GError **error)
+{
+    LobsterResolverWriter *writer = data;
+    GString *buf;
+    const char *args;
+    guint field;
+
+    if (!line) {
+        buf = g_string_new (NULL);
+        for (field = LOBSTER_RESOLVER_SERVERS; field <= LOBSTER_RESOLVER_OPTIONS; field <<= 1) {
+            if ((writer->fields & field) && !(writer->written & field)) {
+                gsize len = buf->len;
+                if (len) {
+                    g_string_append_c (buf, '\n');
+                }
+                append_field (buf, writer->resolver, field);
+                if (buf->len == len + (len != 0)) {
+                    g_string_truncate (buf, len);
+                }
+            }
+        }
+        if (buf->len) {
+            fprintf (stderr, "%s: appending %s\n", file, buf->str);
+        }
+        return g_string_free (buf, FALSE);
+    }
+
+    field = line_field (line, strlen (line), &args);
+    if (!(field & writer->fields)) {
+        fprintf (stderr, "%s:%d: keeping %s\n", file, line_no, line);
+        return line;
+    }
+
+    fprintf (stderr, "%s:%d: rewriting %s\n", file, line_no, line);
+    if (field == LOBSTER_RESOLVER_OPTIONS) {
+        return rewrite_options (writer, args, line + strlen (line));
+    }
+    if (writer->written & field) {
+        return g_strdup ("");
+    }
+    writer->written |= field;
+    buf = g_string_new (NULL);
+    append_field (buf, writer->resolver, field);
+    return g_string_free (buf, FALSE);
+}
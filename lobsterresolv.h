@@ -0,0 +1,75 @@
+#ifndef LOBSTER_RESOLV_H
+#define LOBSTER_RESOLV_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+#include <glib/gerror.h>
+
+#include "lobsteraddr.h"
+#include "lobsterarena.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterResolver LobsterResolver;
+typedef struct _LobsterResolverWriter LobsterResolverWriter;
+
+/* an option that isn't given, so the resolver's default applies */
+#define LOBSTER_RESOLVER_UNSET (-1)
+
+/* parts of a resolver, for diffs and writers */
+typedef enum {
+    LOBSTER_RESOLVER_SERVERS = 1 << 0,
+    LOBSTER_RESOLVER_SEARCH  = 1 << 1,
+    LOBSTER_RESOLVER_OPTIONS = 1 << 2
+} LobsterResolverField;
+
+/* what resolv.conf says about nameserver, search and the options we
+ * know; a resolver is never changed once parsed */
+struct _LobsterResolver {
+    LobsterAddress *servers;        /* in order, without prefixes */
+    guint           n_servers;
+    /* a server as written where the address alone would lose
+     * something, as with fe80::1%eth0, or where it isn't an address
+     * we can read (no family); NULL for the rest, or NULL if there
+     * are none */
+    char          **server_text;
+    char          **search;         /* domains, in order */
+    guint           n_search;
+    int             timeout;        /* seconds */
+    int             attempts;
+    gboolean        rotate;
+    /* something typed in the dialog didn't parse and was left out;
+     * what the file has is kept whatever it is */
+    gboolean        invalid;
+};
+
+/* the line callback data for writing resolv.conf back; fields says
+ * which parts to rewrite, and every other line is kept as it is */
+struct _LobsterResolverWriter {
+    const LobsterResolver *resolver;
+    guint                  fields;
+    guint                  written;     /* internal */
+};
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* parses resolv.conf text; with bare_servers, a line that is only
+ * addresses lists servers, as typed in the dialog, and anything else
+ * makes the resolver invalid rather than being skipped, unless it is
+ * a server known (which may be NULL) kept as written.  Everything is
+ * allocated from arena */
+LobsterResolver *lobster_resolver_parse     (const char *text, gsize len, gboolean bare_servers,
+                                             const LobsterResolver *known, LobsterArena *arena);
+/* the dialog's text for a resolver: a server per line, then search
+ * and options lines if there are any */
+char            *lobster_resolver_to_string (const LobsterResolver *res);
+/* the fields that differ */
+guint            lobster_resolver_diff      (const LobsterResolver *a, const LobsterResolver *b);
+
+char            *lobster_resolver_write_func (const char *file, int line_no, char *line, gpointer data, GError **error);
+
+G_END_DECLS
+
+#endif /* LOBSTER_RESOLV_H */
@@ -0,0 +1,135 @@
+#include "config.h"
+
+#include "lobsterroute.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define SEPARATORS " \t\r"
+
+static gboolean
+next_word (const char **p, const char *end, const char **word, gsize *len)
+{
+    const char *s = *p;
+    while (s < end && strchr (SEPARATORS, *s)) {
+        s++;
+    }
+    if (s == end) {
+        *p = s;
+        return FALSE;
+    }
+    *word = s;
+    while (s < end && !strchr (SEPARATORS, *s)) {
+        s++;
+    }
+    *len = s - *word;
+    *p = s;
+    return TRUE;
+}
+
+static gboolean
+is_dash (const char *word, gsize len)
+{
+    return len == 1 && *word == '-';
+}
+
+gboolean
+lobster_route_parse_line (LobsterRoute *route, const char *line, gsize len, LobsterArena *arena, gboolean *invalid)
+{
+    const char *p = line, *end = line + len;
+    const char *dest, *gateway, *mask, *device;
+    gsize dest_len, gateway_len, mask_len, device_len;
+    gboolean had_prefix;
+
+    memset (route, 0, sizeof (*route));
+    lobster_address_clear (&route->destination);
+    lobster_address_clear (&route->gateway);
+
+    if (!next_word (&p, end, &dest, &dest_len) || *dest == '#') {
+        return FALSE;
+    }
+    if (!next_word (&p, end, &gateway, &gateway_len)) {
+        goto invalid;
+    }
+    /* the netmask and device may be left off */
+    if (!next_word (&p, end, &mask, &mask_len)) {
+        mask = "-";
+        mask_len = 1;
+    }
+    if (!next_word (&p, end, &device, &device_len)) {
+        device = "-";
+        device_len = 1;
+    }
+
+    if (!is_dash (gateway, gateway_len) &&
+        !lobster_address_parse (&route->gateway, gateway, gateway_len, &had_prefix)) {
+        goto invalid;
+    }
+
+    if (dest_len == strlen ("default") && !memcmp (dest, "default", dest_len)) {
+        route->destination.family = route->gateway.family == AF_INET6 ? AF_INET6 : AF_INET;
+        route->destination.prefix = 0;
+    } else {
+        if (!lobster_address_parse (&route->destination, dest, dest_len, &had_prefix)) {
+            goto invalid;
+        }
+        /* a netmask of - with no prefix is a host route */
+        if (!had_prefix && !is_dash (mask, mask_len) &&
+            !lobster_address_parse_prefix (&route->destination, mask, mask_len)) {
+            goto invalid;
+        }
+    }
+    /* 0.0.0.0 is how some write "no gateway" */
+    if (route->gateway.family == AF_INET && !memcmp (route->gateway.bytes, "\0\0\0\0", 4)) {
+        lobster_address_clear (&route->gateway);
+    }
+
+    if (!is_dash (device, device_len)) {
+        route->device = lobster_arena_intern (arena, device, device_len);
+    }
+    while (p < end && strchr (SEPARATORS, *p)) {
+        p++;
+    }
+    while (end > p && strchr (SEPARATORS, end[-1])) {
+        end--;
+    }
+    if (p < end) {
+        route->options = lobster_arena_strndup (arena, p, end - p);
+    }
+    return TRUE;
+
+invalid:
+    if (invalid) {
+        *invalid = TRUE;
+    }
+    return FALSE;
+}
+
+LobsterRouteTable *
+lobster_route_table_new (const LobsterRoute *routes, guint n_routes, guint n_invalid, LobsterArena *arena)
+{
+    LobsterRouteTable *table = lobster_arena_new0 (arena, LobsterRouteTable);
+    guint i;
+
+    table->routes = lobster_arena_alloc0 (arena, n_routes * sizeof (LobsterRoute));
+    memcpy (table->routes, routes, n_routes * sizeof (LobsterRoute));
+    table->n_routes = n_routes;
+    table->n_invalid = n_invalid;
+
+    table->trie = lobster_trie_new (arena);
+    for (i = 0; i < n_routes; i++) {
+        lobster_trie_insert (table->trie, &routes[i].destination, i, NULL);
+    }
+    return table;
+}
+
+const LobsterRoute *
+lobster_route_table_lookup (const LobsterRouteTable *table, const LobsterAddress *addr)
+{
+    guint index;
+    return lobster_trie_lookup (table->trie, addr, &index) ? &table->routes[index] : NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef LOBSTER_ROUTE_H
+#define LOBSTER_ROUTE_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+
+#include "lobsteraddr.h"
+#include "lobsterarena.h"
+#include "lobstertrie.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterRoute LobsterRoute;
+typedef struct _LobsterRouteTable LobsterRouteTable;
+
+/* a line of the routes file: destination gateway netmask device
+ * [type] [options] */
+struct _LobsterRoute {
+    LobsterAddress  destination;    /* a network; default is prefix 0 */
+    LobsterAddress  gateway;        /* no family for - */
+    char           *device;         /* NULL for - */
+    char           *options;        /* the rest of the line, as written */
+    guint           line_no;
+};
+
+/* never changed once made, so snapshots share it */
+struct _LobsterRouteTable {
+    LobsterRoute   *routes;         /* in file order */
+    guint           n_routes;
+    guint           n_invalid;      /* lines that aren't routes we understand */
+    LobsterTrie    *trie;           /* index by destination */
+};
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* parses a routes line into route, with strings from arena; returns
+ * FALSE for a line that isn't a route, and sets *invalid if it looked
+ * like one but didn't parse */
+gboolean                 lobster_route_parse_line  (LobsterRoute *route, const char *line, gsize len,
+                                                    LobsterArena *arena, gboolean *invalid);
+/* copies n routes into a table in arena and indexes them; of routes
+ * to the same network the first wins, as it does in the kernel */
+LobsterRouteTable       *lobster_route_table_new   (const LobsterRoute *routes, guint n_routes, guint n_invalid,
+                                                    LobsterArena *arena);
+/* the route with the longest destination that holds addr */
+const LobsterRoute      *lobster_route_table_lookup (const LobsterRouteTable *table, const LobsterAddress *addr);
+
+G_END_DECLS
+
+#endif /* LOBSTER_ROUTE_H */
@@ -0,0 +1,386 @@
+#include "config.h"
+
+#include "lobsterschema.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Keys are found with a perfect hash generated the first time a schema
+ * is used: a seed is searched for that sends every key name (or prefix)
+ * to its own slot.  A line costs one hash of its key, plus at most two
+ * more for prefix keys: one with trailing digits stripped
+ * (BONDING_SLAVE0) and one cut after the first '_' (IPADDR_foo).
+ */
+
+#define FIELD(record, key, type) (*(type *)((char *)(record) + (key)->offset))
+
+static guint32
+hash_name (guint32 seed, const char *name, gsize len)
+{
+    guint32 h = seed ^ 2166136261u;
+    while (len--) {
+        h = (h ^ (guchar)*name++) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static gboolean
+try_seed (LobsterSchema *schema, guint32 seed, guint32 mask)
+{
+    const LobsterSchemaKey *key;
+    guint32 slot;
+    guint i;
+
+    memset (schema->slots, -1, mask + 1);
+    for (i = 0, key = schema->keys; i < schema->n_keys; i++, key++) {
+        slot = hash_name (seed, key->name, strlen (key->name)) & mask;
+        if (schema->slots[slot] >= 0) {
+            return FALSE;
+        }
+        schema->slots[slot] = i;
+    }
+    return TRUE;
+}
+
+static void
+prepare (LobsterSchema *schema)
+{
+    guint32 mask, seed;
+
+    if (!g_once_init_enter (&schema->prepared)) {
+        return;
+    }
+
+    g_assert (schema->n_keys <= 64);
+    for (mask = 1; mask + 1 < schema->n_keys * 2; mask = mask * 2 + 1)
+        ;
+    for (;;) {
+        schema->slots = g_realloc (schema->slots, mask + 1);
+        for (seed = 0; seed < 4096; seed++) {
+            if (try_seed (schema, seed, mask)) {
+                schema->seed = seed;
+                schema->mask = mask;
+                g_once_init_leave (&schema->prepared, 1);
+                return;
+            }
+        }
+        mask = mask * 2 + 1;
+    }
+}
+
+static int
+lookup_exact (LobsterSchema *schema, const char *name, gsize len, gboolean prefix)
+{
+    const LobsterSchemaKey *key;
+    int i = schema->slots[hash_name (schema->seed, name, len) & schema->mask];
+
+    if (i < 0) {
+        return -1;
+    }
+    key = &schema->keys[i];
+    if (!(key->flags & LOBSTER_SCHEMA_PREFIX) != !prefix ||
+        strncmp (key->name, name, len) || key->name[len]) {
+        return -1;
+    }
+    return i;
+}
+
+static int
+lookup (LobsterSchema *schema, const char *name, gsize len)
+{
+    const char *underscore;
+    gsize stem;
+    int i;
+
+    if ((i = lookup_exact (schema, name, len, FALSE)) >= 0) {
+        return i;
+    }
+    for (stem = len; stem && g_ascii_isdigit (name[stem - 1]); stem--)
+        ;
+    if (stem < len && stem && (i = lookup_exact (schema, name, stem, TRUE)) >= 0) {
+        return i;
+    }
+    underscore = memchr (name, '_', len);
+    if (underscore && underscore + 1 < name + len) {
+        return lookup_exact (schema, name, underscore + 1 - name, TRUE);
+    }
+    return -1;
+}
+
+/* splits a line into key and unquoted value */
+static gboolean
+split_line (LobsterSchema *schema, const char *line, gsize len,
+            const char **name, gsize *name_len, const char **value, gsize *value_len)
+{
+    const char *end = line + len;
+    const char *p;
+    const char *close;
+
+    while (line < end && g_ascii_isspace (*line)) {
+        line++;
+    }
+    if (line == end || *line == '#') {
+        return FALSE;
+    }
+
+    *name = line;
+    if (schema->syntax == LOBSTER_SCHEMA_WORDS) {
+        for (p = line; p < end && !g_ascii_isspace (*p); p++)
+            ;
+        *name_len = p - line;
+        while (p < end && g_ascii_isspace (*p)) {
+            p++;
+        }
+        *value = p;
+        *value_len = end - p;
+        return TRUE;
+    }
+
+    for (p = line; p < end && (g_ascii_isalnum (*p) || *p == '_'); p++)
+        ;
+    if (p == line || p == end || *p != '=') {
+        return FALSE;
+    }
+    *name_len = p - line;
+
+    p++;
+    if (p < end && (*p == '\'' || *p == '"')) {
+        close = memchr (p + 1, *p, end - p - 1);
+        *value = p + 1;
+        *value_len = (close ? close : end) - *value;
+    } else {
+        *value = p;
+        for (; p < end && !g_ascii_isspace (*p) && *p != '#'; p++)
+            ;
+        *value_len = p - *value;
+    }
+    return TRUE;
+}
+
+static gboolean
+is_yes (const char *value, gsize len)
+{
+    return len >= 3 && !g_ascii_strncasecmp (value, "yes", 3);
+}
+
+static char *
+arena_value (const LobsterSchemaKey *key, LobsterArena *arena, const char *value, gsize len)
+{
+    return key->flags & LOBSTER_SCHEMA_INTERN
+        ? lobster_arena_intern (arena, value, len)
+        : lobster_arena_strndup (arena, value, len);
+}
+
+static void
+parse_value (const LobsterSchemaKey *key, gpointer record, const char *name, gsize name_len,
+             const char *value, gsize len, LobsterArena *arena)
+{
+    GHashTable **table;
+
+    switch (key->type) {
+    case LOBSTER_SCHEMA_STRING:
+        if (arena) {
+            FIELD (record, key, char *) = arena_value (key, arena, value, len);
+        } else {
+            g_free (FIELD (record, key, char *));
+            FIELD (record, key, char *) = g_strndup (value, len);
+        }
+        break;
+    case LOBSTER_SCHEMA_BOOLEAN:
+        FIELD (record, key, gboolean) = is_yes (value, len);
+        break;
+    case LOBSTER_SCHEMA_TABLE:
+        table = &FIELD (record, key, GHashTable *);
+        if (arena) {
+            if (!*table) {
+                *table = g_hash_table_new (g_str_hash, g_str_equal);
+            }
+            /* the names always repeat */
+            g_hash_table_replace (*table, lobster_arena_intern (arena, name, name_len),
+                                  arena_value (key, arena, value, len));
+        } else {
+            if (!*table) {
+                *table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+            }
+            g_hash_table_replace (*table, g_strndup (name, name_len), g_strndup (value, len));
+        }
+        break;
+    case LOBSTER_SCHEMA_CUSTOM:
+        key->parse (record, value, len, arena);
+        break;
+    }
+}
+
+gboolean
+lobster_schema_read_line (LobsterSchema *schema, const char *line, gsize len, gpointer record,
+                          LobsterArena *arena)
+{
+    const char *name, *value;
+    gsize name_len, value_len;
+    int i;
+
+    prepare (schema);
+
+    if (!split_line (schema, line, len, &name, &name_len, &value, &value_len) ||
+        (i = lookup (schema, name, name_len)) < 0) {
+        return FALSE;
+    }
+    parse_value (&schema->keys[i], record, name, name_len, value, value_len, arena);
+    return TRUE;
+}
+
+/* returns the new value, or NULL to keep old */
+static char *
+format_value (const LobsterSchemaKey *key, gconstpointer record, const char *name, gsize name_len,
+              const char *old, gsize old_len)
+{
+    const char *str;
+    GHashTable *table;
+    char *table_name;
+    gboolean b;
+
+    switch (key->type) {
+    case LOBSTER_SCHEMA_STRING:
+        str = FIELD (record, key, char *);
+        if (!str || (old && strlen (str) == old_len && !strncmp (str, old, old_len))) {
+            return NULL;
+        }
+        return g_strdup (str);
+    case LOBSTER_SCHEMA_BOOLEAN:
+        b = FIELD (record, key, gboolean);
+        if (old && !b == !is_yes (old, old_len)) {
+            return NULL;
+        }
+        return g_strdup (b ? "yes" : "no");
+    case LOBSTER_SCHEMA_TABLE:
+        table = FIELD (record, key, GHashTable *);
+        if (!table) {
+            return NULL;
+        }
+        table_name = g_strndup (name, name_len);
+        str = g_hash_table_lookup (table, table_name);
+        g_free (table_name);
+        if (!str || (old && strlen (str) == old_len && !strncmp (str, old, old_len))) {
+            return NULL;
+        }
+        return g_strdup (str);
+    case LOBSTER_SCHEMA_CUSTOM:
+        return key->format (record, old, old_len);
+    }
+    return NULL;
+}
+
+/* quote is the one the line used before, if any */
+static void
+append_assignment (GString *buf, LobsterSchema *schema, const char *name, gsize name_len, const char *value, char quote)
+{
+    if (!quote) {
+        quote = schema->quote;
+    }
+    if (strchr (value, quote)) {
+        quote = quote == '"' ? '\'' : '"';
+    }
+
+    g_string_append_len (buf, name, name_len);
+    if (schema->syntax == LOBSTER_SCHEMA_WORDS) {
+        g_string_append_printf (buf, " %s", value);
+    } else {
+        g_string_append_printf (buf, "=%c%s%c", quote, value, quote);
+    }
+}
+
+char *
+lobster_schema_write_func (const char *file, int line_no, char *line, gpointer data, GError **error)
+{
+    LobsterSchemaWriter *writer = data;
+    LobsterSchema *schema = writer->schema;
+    const LobsterSchemaKey *key;
+    const char *name, *value;
+    gsize name_len, value_len;
+    GString *buf;
+    char *new_value;
+    char quote;
+    int i;
+
+    prepare (schema);
+
+    if (!line) {
+        buf = g_string_new (NULL);
+        for (i = 0, key = schema->keys; i < schema->n_keys; i++, key++) {
+            if (!(key->flags & LOBSTER_SCHEMA_APPEND) || (key->flags & LOBSTER_SCHEMA_PREFIX) ||
+                !(writer->keys & (G_GUINT64_CONSTANT (1) << i)) ||
+                (writer->written & (G_GUINT64_CONSTANT (1) << i))) {
+                continue;
+            }
+            new_value = format_value (key, writer->record, key->name, strlen (key->name), NULL, 0);
+            if (new_value) {
+                if (buf->len) {
+                    g_string_append_c (buf, '\n');
+                }
+                append_assignment (buf, schema, key->name, strlen (key->name), new_value, 0);
+                fprintf (stderr, "%s: appending %s\n", file, key->name);
+                g_free (new_value);
+            }
+        }
+        return g_string_free (buf, FALSE);
+    }
+
+    if (!split_line (schema, line, strlen (line), &name, &name_len, &value, &value_len) ||
+        (i = lookup (schema, name, name_len)) < 0 ||
+        !(writer->keys & (G_GUINT64_CONSTANT (1) << i))) {
+        return line;
+    }
+
+    key = &schema->keys[i];
+    writer->written |= G_GUINT64_CONSTANT (1) << i;
+    new_value = format_value (key, writer->record, name, name_len, value, value_len);
+    if (!new_value) {
+        return line;
+    }
+
+    fprintf (stderr, "%s:%d: rewriting %.*s\n", file, line_no, (int)name_len, name);
+    buf = g_string_new (NULL);
+    /* keep any indentation */
+    g_string_append_len (buf, line, name - line);
+    quote = value > line && (value[-1] == '\'' || value[-1] == '"') ? value[-1] : 0;
+    append_assignment (buf, schema, name, name_len, new_value, quote);
+    if (schema->syntax == LOBSTER_SCHEMA_ASSIGN) {
+        /* and whatever followed the value, such as a comment */
+        value += value_len;
+        if (value < line + strlen (line) && (*value == '\'' || *value == '"')) {
+            value++;
+        }
+        g_string_append (buf, value);
+    }
+    g_free (new_value);
+    return g_string_free (buf, FALSE);
+}
+
+void
+lobster_schema_clear (LobsterSchema *schema, gpointer record, LobsterArena *arena)
+{
+    const LobsterSchemaKey *key;
+    guint i;
+
+    for (i = 0, key = schema->keys; i < schema->n_keys; i++, key++) {
+        switch (key->type) {
+        case LOBSTER_SCHEMA_STRING:
+            if (!arena) {
+                g_free (FIELD (record, key, char *));
+            }
+            FIELD (record, key, char *) = NULL;
+            break;
+        case LOBSTER_SCHEMA_TABLE:
+            if (FIELD (record, key, GHashTable *)) {
+                g_hash_table_destroy (FIELD (record, key, GHashTable *));
+                FIELD (record, key, GHashTable *) = NULL;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
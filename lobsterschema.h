@@ -0,0 +1,87 @@
+#ifndef LOBSTER_SCHEMA_H
+#define LOBSTER_SCHEMA_H
+
+#include <glib/gmacros.h>
+#include <glib/gerror.h>
+
+#include "lobsterarena.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterSchema       LobsterSchema;
+typedef struct _LobsterSchemaKey    LobsterSchemaKey;
+typedef struct _LobsterSchemaWriter LobsterSchemaWriter;
+
+typedef enum {
+    LOBSTER_SCHEMA_ASSIGN,      /* KEY='value', as in ifcfg and sysconfig files */
+    LOBSTER_SCHEMA_WORDS        /* key value..., as in routes */
+} LobsterSchemaSyntax;
+
+typedef enum {
+    LOBSTER_SCHEMA_STRING,      /* char * */
+    LOBSTER_SCHEMA_BOOLEAN,     /* gboolean, from yes/no */
+    LOBSTER_SCHEMA_TABLE,       /* GHashTable * of full key name -> value, for prefix keys */
+    LOBSTER_SCHEMA_CUSTOM
+} LobsterSchemaType;
+
+typedef enum {
+    LOBSTER_SCHEMA_PREFIX = 1 << 0,     /* name is a prefix, as in IPADDR_foo or BONDING_SLAVE0 */
+    LOBSTER_SCHEMA_APPEND = 1 << 1,     /* write the key at the end if the file lacks it */
+    LOBSTER_SCHEMA_INTERN = 1 << 2      /* values repeat across files, so share them in the arena */
+} LobsterSchemaFlags;
+
+/* parse stores the value in the record, allocating from arena if it is
+ * not NULL.  format returns the new value, or NULL if old (which is NULL
+ * when appending) is already right. */
+typedef void  (*LobsterSchemaParseFunc)  (gpointer record, const char *value, gsize len, LobsterArena *arena);
+typedef char *(*LobsterSchemaFormatFunc) (gconstpointer record, const char *old, gsize old_len);
+
+struct _LobsterSchemaKey {
+    const char              *name;
+    LobsterSchemaType        type;
+    guint                    flags;
+    gsize                    offset;    /* of the field in the record, for the built in types */
+    LobsterSchemaParseFunc   parse;     /* for LOBSTER_SCHEMA_CUSTOM */
+    LobsterSchemaFormatFunc  format;
+};
+
+struct _LobsterSchema {
+    LobsterSchemaSyntax      syntax;
+    char                     quote;     /* used when writing LOBSTER_SCHEMA_ASSIGN values */
+    const LobsterSchemaKey  *keys;
+    guint                    n_keys;
+
+    /* the perfect hash, generated on first use */
+    volatile gsize           prepared;
+    guint32                  seed;
+    guint32                  mask;
+    gint8                   *slots;
+};
+
+#define LOBSTER_SCHEMA_INIT(syntax, quote, keys) { (syntax), (quote), (keys), G_N_ELEMENTS (keys), 0, 0, 0, NULL }
+
+struct _LobsterSchemaWriter {
+    LobsterSchema *schema;
+    gconstpointer  record;
+    guint64        keys;        /* to write, by key index; other lines are kept */
+    guint64        written;
+};
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* returns whether line held a key from the schema.  Strings and table
+ * entries are allocated from arena, or are heap strings if it is NULL;
+ * pass the same arena to lobster_schema_clear. */
+gboolean lobster_schema_read_line  (LobsterSchema *schema, const char *line, gsize len, gpointer record,
+                                    LobsterArena *arena);
+
+/* a LobsterIOWriteFileFunc; data is a LobsterSchemaWriter */
+char    *lobster_schema_write_func (const char *file, int line_no, char *line, gpointer data, GError **error);
+
+void     lobster_schema_clear      (LobsterSchema *schema, gpointer record, LobsterArena *arena);
+
+G_END_DECLS
+
+#endif /* LOBSTER_SCHEMA_H */
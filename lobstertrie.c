@@ -0,0 +1,209 @@
+#include "config.h"
+
+#include "lobstertrie.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Each node is a network: the first bits of key.  A node's children
+ * extend it by at least one bit, the next of which picks the child, so
+ * runs of single children are never stored and the depth is bounded by
+ * the address length.  Nodes that only join two others have no value.
+ * There is a root per family, and every node comes from one arena.
+ */
+
+typedef struct _Node Node;
+
+struct _Node {
+    guint8    key[16];      /* bits past the prefix are zero */
+    guint8    bits;
+    gboolean  has_value;
+    guint     value;
+    Node     *child[2];
+};
+
+struct _LobsterTrie {
+    LobsterArena *arena;
+    gboolean      own_arena;
+    Node         *root[2];      /* IPv4, IPv6 */
+};
+
+#define BIT(key, i) ((key)[(i) >> 3] >> (7 - ((i) & 7)) & 1)
+
+LobsterTrie *
+lobster_trie_new (LobsterArena *arena)
+{
+    gboolean own_arena = !arena;
+    LobsterTrie *trie;
+
+    if (own_arena) {
+        arena = lobster_arena_new ();
+    }
+    trie = lobster_arena_new0 (arena, LobsterTrie);
+    trie->arena = arena;
+    trie->own_arena = own_arena;
+    return trie;
+}
+
+void
+lobster_trie_free (LobsterTrie *trie)
+{
+    if (trie && trie->own_arena) {
+        lobster_arena_unref (trie->arena);
+    }
+}
+
+/* the network of addr in key, and the root it goes under; NULL for no
+ * address */
+static Node **
+address_key (LobsterTrie *trie, const LobsterAddress *addr, guint8 *key, guint *bits)
+{
+    guint max;
+
+    if (addr->family == AF_INET) {
+        max = 32;
+    } else if (addr->family == AF_INET6) {
+        max = 128;
+    } else {
+        return NULL;
+    }
+    *bits = addr->prefix == LOBSTER_ADDRESS_NO_PREFIX ? max : MIN (addr->prefix, max);
+
+    memset (key, 0, 16);
+    memcpy (key, addr->bytes, (*bits + 7) / 8);
+    if (*bits & 7) {
+        key[*bits / 8] &= 0xff00 >> (*bits & 7);
+    }
+    return &trie->root[addr->family == AF_INET6];
+}
+
+/* how many of the first max bits a and b share */
+static guint
+common_bits (const guint8 *a, const guint8 *b, guint max)
+{
+    guint i, n = 0;
+    guint8 diff;
+
+    for (i = 0; n < max; i++, n += 8) {
+        if ((diff = a[i] ^ b[i])) {
+            n += 8 - g_bit_storage (diff);
+            break;
+        }
+    }
+    return MIN (n, max);
+}
+
+static Node *
+node_new (LobsterTrie *trie, const guint8 *key, guint bits)
+{
+    Node *node = lobster_arena_new0 (trie->arena, Node);
+    memcpy (node->key, key, (bits + 7) / 8);
+    if (bits & 7) {
+        node->key[bits / 8] &= 0xff00 >> (bits & 7);
+    }
+    node->bits = bits;
+    return node;
+}
+
+gboolean
+lobster_trie_insert (LobsterTrie *trie, const LobsterAddress *addr, guint value, guint *other)
+{
+    guint8 key[16];
+    Node **link, *node, *split;
+    guint bits, common;
+
+    if (!(link = address_key (trie, addr, key, &bits))) {
+        return TRUE;
+    }
+    for (;;) {
+        node = *link;
+        if (!node) {
+            node = *link = node_new (trie, key, bits);
+            break;
+        }
+        common = common_bits (node->key, key, MIN (node->bits, bits));
+        if (common < node->bits) {
+            /* the new network branches off, or sits, above node */
+            split = *link = node_new (trie, key, common);
+            split->child[BIT (node->key, common)] = node;
+            node = split;
+            if (common < bits) {
+                node = split->child[BIT (key, common)] = node_new (trie, key, bits);
+            }
+            break;
+        }
+        if (node->bits == bits) {
+            break;
+        }
+        link = &node->child[BIT (key, node->bits)];
+    }
+
+    if (node->has_value) {
+        if (other) {
+            *other = node->value;
+        }
+        return FALSE;
+    }
+    node->has_value = TRUE;
+    node->value = value;
+    return TRUE;
+}
+
+gboolean
+lobster_trie_lookup (LobsterTrie *trie, const LobsterAddress *addr, guint *value)
+{
+    guint8 key[16];
+    Node **root, *node, *best = NULL;
+    guint bits;
+
+    if (!(root = address_key (trie, addr, key, &bits))) {
+        return FALSE;
+    }
+    for (node = *root; node && node->bits <= bits; node = node->child[BIT (key, node->bits)]) {
+        if (common_bits (node->key, key, node->bits) < node->bits) {
+            break;
+        }
+        if (node->has_value) {
+            best = node;
+        }
+        if (node->bits == bits) {
+            break;
+        }
+    }
+    if (best && value) {
+        *value = best->value;
+    }
+    return best != NULL;
+}
+
+/* a network with a value under the one with value outer, which the
+ * first call passes as NULL */
+static gboolean
+find_overlap (const Node *node, const Node *outer, guint *outer_value, guint *inner_value)
+{
+    if (!node) {
+        return FALSE;
+    }
+    if (node->has_value) {
+        if (outer) {
+            *outer_value = outer->value;
+            *inner_value = node->value;
+            return TRUE;
+        }
+        outer = node;
+    }
+    return find_overlap (node->child[0], outer, outer_value, inner_value) ||
+        find_overlap (node->child[1], outer, outer_value, inner_value);
+}
+
+gboolean
+lobster_trie_find_overlap (LobsterTrie *trie, guint *outer, guint *inner)
+{
+    return find_overlap (trie->root[0], NULL, outer, inner) ||
+        find_overlap (trie->root[1], NULL, outer, inner);
+}
@@ -0,0 +1,35 @@
+#ifndef LOBSTER_TRIE_H
+#define LOBSTER_TRIE_H
+
+#include <glib/gmacros.h>
+#include <glib/gtypes.h>
+
+#include "lobsteraddr.h"
+#include "lobsterarena.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LobsterTrie LobsterTrie;
+
+G_END_DECLS
+
+G_BEGIN_DECLS
+
+/* a path-compressed binary trie of networks, each with a value.  It
+ * is allocated from arena and goes with it, or with no arena has one
+ * of its own that lobster_trie_free() releases */
+LobsterTrie *lobster_trie_new    (LobsterArena *arena);
+void         lobster_trie_free   (LobsterTrie *trie);
+
+/* adds the network of addr, which is the whole address if it has no
+ * prefix; if that network is there already, returns FALSE with its
+ * value in *other */
+gboolean     lobster_trie_insert (LobsterTrie *trie, const LobsterAddress *addr, guint value, guint *other);
+/* the value of the longest network that holds addr */
+gboolean     lobster_trie_lookup (LobsterTrie *trie, const LobsterAddress *addr, guint *value);
+/* the values of a network and one inside it, if any nest */
+gboolean     lobster_trie_find_overlap (LobsterTrie *trie, guint *outer, guint *inner);
+
+G_END_DECLS
+
+#endif /* LOBSTER_TRIE_H */
@@ -15,10 +15,87 @@
 #include "support.h"
 #include "callbacks.h"
 
+#include <stdio.h>
+#include <string.h>
+
+static char *owner;
+static char *route_to;
+static int apply_window = 500;
+
+static GOptionEntry entries[] = {
+  { "owner", 0, 0, G_OPTION_ARG_STRING, &owner,
+    N_("Print the interface whose subnet holds ADDRESS and exit"), N_("ADDRESS") },
+  { "route-to", 0, 0, G_OPTION_ARG_STRING, &route_to,
+    N_("Print the gateway and device traffic to ADDRESS would use and exit"), N_("ADDRESS") },
+  { "apply-window", 0, 0, G_OPTION_ARG_INT, &apply_window,
+    N_("Wait MSEC after an apply for others to run with it (default 500)"), N_("MSEC") },
+  { NULL }
+};
+
+static gboolean
+load_address (const char *text, LobsterAddress *addr)
+{
+  GError *error = NULL;
+
+  lobster_address_clear (addr);
+  if (!lobster_address_parse (addr, text, strlen (text), NULL)) {
+      fprintf (stderr, "%s: not an address: %s\n", g_get_prgname (), text);
+      return FALSE;
+  }
+  if (!lobster_system_load (&error)) {
+      fprintf (stderr, "%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* exits 1 if no interface has the address */
+static int
+print_owner (const char *text)
+{
+  LobsterAddress addr;
+  LobsterInterface *iface;
+
+  if (!load_address (text, &addr)) {
+      return 2;
+  }
+
+  iface = lobster_interface_get_from_address (&addr);
+  if (!iface) {
+      return 1;
+  }
+  printf ("%s\n", iface->interface);
+  return 0;
+}
+
+/* as "ip route get" puts it; exits 1 if there is no route */
+static int
+print_route (const char *text)
+{
+  LobsterAddress addr, gateway;
+  const char *device;
+  char *via;
+
+  if (!load_address (text, &addr)) {
+      return 2;
+  }
+  if (!lobster_system_route (&addr, &gateway, &device)) {
+      return 1;
+  }
+
+  via = lobster_address_to_string (&gateway, FALSE);
+  printf ("%s%s%s%s%s\n", text, *via ? " via " : "", via, device ? " dev " : "", device ? device : "");
+  g_free (via);
+  return 0;
+}
+
 int
 main (int argc, char *argv[])
 {
   GError *error = NULL;
+  GOptionContext *context;
+  GtkAccelGroup *accel;
 
 #ifdef ENABLE_NLS
   bindtextdomain (GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR);
@@ -27,11 +104,30 @@ main (int argc, char *argv[])
 #endif
 
   gtk_set_locale ();
+
+  /* the display is only opened for the dialog */
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  g_option_context_add_group (context, gtk_get_option_group (FALSE));
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+      fprintf (stderr, "%s: %s\n", g_get_prgname (), error->message);
+      return 2;
+  }
+  g_option_context_free (context);
+  lobster.save_window = MAX (apply_window, 0);
+
+  if (owner) {
+      return print_owner (owner);
+  }
+  if (route_to) {
+      return print_route (route_to);
+  }
+
   gtk_init (&argc, &argv);
 
   add_pixmap_directory (PACKAGE_DATA_DIR "/" PACKAGE "/pixmaps");
 
-  if (!lobster_system_load (&error)) {
+  if (!lobster_system_load_devices (&error)) {
       lobster_show_error (_("<b>Could not load network configuration:</b>"), error);
       return 1;
   }
@@ -41,6 +137,15 @@ main (int argc, char *argv[])
   /* glade can't do this automatically... */
   g_signal_connect (BUFFER ("dns_text"), "changed", G_CALLBACK (on_dns_text_changed), NULL);
 
+  /* ...or accelerators without a menu item */
+  accel = gtk_accel_group_new ();
+  gtk_accel_group_connect (accel, GDK_z, GDK_CONTROL_MASK, 0,
+                           g_cclosure_new (G_CALLBACK (on_undo_activated), NULL, NULL));
+  gtk_accel_group_connect (accel, GDK_z, GDK_CONTROL_MASK | GDK_SHIFT_MASK, 0,
+                           g_cclosure_new (G_CALLBACK (on_redo_activated), NULL, NULL));
+  gtk_window_add_accel_group (GTK_WINDOW (lobster.dialog), accel);
+  g_object_unref (accel);
+
   lobster_system_display ();
   
   if (!g_file_test ("/usr/bin/nm-editor", G_FILE_TEST_IS_EXECUTABLE)) {